@@ -11,24 +11,63 @@ zmac {
 zmac {
     name = "bios",
     srcs = { "./bios.z80" },
-    deps = {
-        "include/*.lib",
-        "./include/*.lib"
+    incdirs = {
+        "include",
+        "./include"
     },
 }
 
--- Builds the memory image.
+-- Builds the part of the memory image which goes on the boot track...
 ld80 {
     name = "bootfile_mem",
     srcs = {
+        "--window=e400:f77f",
         "-Pe400", "third_party/zcpr1+zcpr",
         "-Pec00", "third_party/zsdos+zsdos",
         "-Pfa00", "+bios",
     }
 }
 
--- Repackages the memory image as a boot track. This doesn't include the extra
--- section of boot image which exists above the directory.
+-- ...and the rest of it, which doesn't fit.
+ld80 {
+    name = "bootextra_mem",
+    srcs = {
+        "--window=f780:",
+        "-Pe400", "third_party/zcpr1+zcpr",
+        "-Pec00", "third_party/zsdos+zsdos",
+        "-Pfa00", "+bios",
+    }
+}
+
+-- Nothing in the boot track link refers to ZSDOS or the BIOS, so this checks
+-- that --gc-sections keeps what was placed with -P: the image must not change.
+ld80 {
+    name = "bootfile_gc_mem",
+    srcs = {
+        "--gc-sections",
+        "--window=e400:f77f",
+        "-Pe400", "third_party/zcpr1+zcpr",
+        "-Pec00", "third_party/zsdos+zsdos",
+        "-Pfa00", "+bios",
+    }
+}
+
+normalrule {
+    name = "gc_check",
+    ins = {
+        "+bootfile_mem",
+        "+bootfile_gc_mem"
+    },
+    outleaves = { "gc_check.txt" },
+    commands = {
+        "cmp %{ins[1]} %{ins[2]}",
+        "grep '^Removed' %{ins[2]}.sym > %{outs}"
+    }
+}
+
+-- Puts the boot sector in front of the memory image to make the boot track.
+-- This doesn't include the extra section of boot image which exists above the
+-- directory.
 normalrule {
     name = "bootfile",
     ins = {
@@ -38,8 +77,7 @@ normalrule {
     outleaves = { "bootfile.img" },
     commands = {
         "dd if=%{ins[1]} of=%{outs} status=none bs=128 count=1",
-        "dd if=%{ins[3]} of=%{outs} status=none bs=128 seek=1 skip=456 count=16",
-        "dd if=%{ins[3]} of=%{outs} status=none bs=128 seek=17 skip=472 count=23",
+        "dd if=%{ins[3]} of=%{outs} status=none bs=128 seek=1",
     }
 }
 
@@ -63,12 +101,12 @@ normalrule {
     name = "diskimage",
     ins = {
         "+partialimg",
-        "+bootfile_mem"
+        "+bootextra_mem"
     },
     outleaves = { "diskimage.img" },
     commands = {
         "cp %{ins[1]} %{outs}",
         "truncate -s 204800 %{outs}",
-        "dd if=%{ins[2]} of=%{outs} status=none bs=128 seek=56 skip=495 count=9 conv=notrunc"
+        "dd if=%{ins[2]} of=%{outs} status=none bs=128 seek=56 count=9 conv=notrunc"
     }
 }
@@ -5,9 +5,9 @@ include "utils/build.lua"
 zmac {
     name = "auto",
     srcs = { "./auto.z80" },
-    deps = {
-        "include/*.lib",
-        "./include/*.lib"
+    incdirs = {
+        "include",
+        "./include"
     },
     relocatable = false
 }
@@ -23,9 +23,11 @@ for _, f in pairs(bootfiles) do
     zmac {
         name = base,
         srcs = { f },
+        incdirs = {
+            "include",
+            "./include"
+        },
         deps = {
-            "include/*.lib",
-            "./include/*.lib",
             "+auto_inc"
         }
     }
@@ -34,16 +36,19 @@ end
 zmac {
     name = "bios",
     srcs = { "./bios.z80" },
-    deps = {
-        "include/*.lib",
-        "./include/*.lib"
+    incdirs = {
+        "include",
+        "./include"
     },
 }
 
--- Builds the memory image.
+-- Builds the boot track: the bottom of the memory image, followed by the top
+-- of it.
 ld80 {
-    name = "bootfile_mem",
+    name = "bootfile",
     srcs = {
+        "--window=0000:23ff",
+        "--window=e800:",
         "-P0000", "+startup.z80",
         "-P000b", "+bpb1.z80",
         "-P0038", "+sirq.z80",
@@ -59,17 +64,6 @@ ld80 {
     }
 }
 
--- Repackages the memory image as a boot track.
-normalrule {
-    name = "bootfile",
-    ins = { "+bootfile_mem" },
-    outleaves = { "bootfile.img" },
-    commands = {
-        "dd if=%{ins[1]} of=%{outs} status=none bs=256 count=36",
-        "dd if=%{ins[1]} of=%{outs} status=none bs=256 seek=36 skip=232 count=24"
-    }
-}
-
 diskimage {
     name = "diskimage",
     format = "nc200cpm",
@@ -24,10 +24,11 @@ normalrule {
 zmac {
     name = "supervisor",
     srcs = { "./supervisor.z80" },
+    incdirs = {
+        "include",
+        "arch/nc200/include",
+    },
     deps = {
-        "include/*.lib",
-        "arch/nc200/include/*.lib",
-        "./*.inc",
         "+keytab_inc",
         "+font_inc",
     },
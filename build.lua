@@ -11,3 +11,19 @@ installable {
         ["kayproii.img"] = "arch/kayproii+diskimage",
     }
 }
+
+installable {
+    name = "check",
+    map = {
+        ["kayproii-gc.txt"] = "arch/kayproii+gc_check",
+    }
+}
+
+-- The emulator workloads, utils/bench+benchmark, only go in here once
+-- utils/bench/baseline.txt holds real numbers; until then they can only fail.
+installable {
+    name = "benchmark",
+    map = {
+        ["ld80bench.txt"] = "utils/bench+ld80bench",
+    }
+}
@@ -607,13 +607,17 @@ local function install_make_emitter()
 		emit(name.."="..value.."\n")
 	end
 
-	function emitter:rule(name, ins, outs)
+	function emitter:rule(name, ins, outs, depfile)
 		if (#outs == 0) then
 			local n = name.."-IMAGINARY-OUT"
 			emit(".INTERMEDIATE:", n, "\n")
 			outs = {n}
 		end
 
+		if depfile then
+			emit("-include", depfile, "\n")
+		end
+
 		local impl = name.."-IMPL"
 		emit(".INTERMEDIATE:", name, "\n")
 		emit(".INTERMEDIATE:", impl, "\n")
@@ -658,6 +662,10 @@ local function install_make_emitter()
 end
 
 local function install_ninja_emitter()
+	-- The zmac rules write one depfile covering both .rel and .lst, which
+	-- older ninjas reject.
+	emit("ninja_required_version = 1.10\n")
+	emit("\n")
 	emit("rule build\n")
 	emit("  command = $command\n")
 	emit("\n")
@@ -679,12 +687,16 @@ local function install_ninja_emitter()
 		emit(name.."="..unmake(value).."\n")
 	end
 
-	function emitter:rule(name, ins, outs)
+	function emitter:rule(name, ins, outs, depfile)
 		if (#outs == 0) then
 			emit("build", name, ": phony", unmake(ins), "\n")
 		else
 			emit("build", name, ": phony", unmake(outs), "\n")
 			emit("build", unmake(outs), ": build", unmake(ins), "\n")
+			if depfile then
+				emit("  depfile =", unmake(depfile), "\n")
+				emit("  deps = gcc\n")
+			end
 		end
 	end
 
@@ -706,16 +718,18 @@ definerule("simplerule",
 		outs = { type="strings" },
 		deps = { type="targets", default={} },
 		label = { type="string", optional=true },
+		depfile = { type="string", optional=true },
 		commands = { type="strings" },
 		vars = { type="table", default={} },
 	},
 	function (e)
-		emitter:rule(e.fullname, filenamesof(e.ins, e.deps), e.outs)
+		emitter:rule(e.fullname, filenamesof(e.ins, e.deps), e.outs, e.depfile)
 		emitter:label(e.fullname, " ", e.label or "")
 
 		local vars = inherit(e.vars, {
 			ins = filenamesof(e.ins),
-			outs = filenamesof(e.outs)
+			outs = filenamesof(e.outs),
+			depfile = e.depfile
 		})
 
 		emitter:exec(templateexpand(e.commands, vars))
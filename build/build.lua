@@ -7,6 +7,7 @@ definerule("normalrule",
 		ins = { type="targets" },
 		deps = { type="targets", default={} },
 		outleaves = { type="strings" },
+		depleaf = { type="string", optional=true },
 		label = { type="string", optional=true },
 		objdir = { type="string", optional=true },
 		commands = { type="strings" },
@@ -17,6 +18,7 @@ definerule("normalrule",
 		for _, v in pairs(e.outleaves) do
 			realouts[#realouts+1] = concatpath(dir, v)
 		end
+		local depfile = e.depleaf and concatpath(dir, e.depleaf)
 
 		local vars = inherit(e.vars, {
 			dir = dir
@@ -27,6 +29,7 @@ definerule("normalrule",
 			ins = e.ins,
 			deps = e.deps,
 			outs = realouts,
+			depfile = depfile,
 			label = e.label,
 			commands = e.commands,
 			vars = vars,
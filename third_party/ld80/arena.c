@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "ld80.h"
+
+/*
+ * Sections, fixups and the like live until the link is finished, so
+ * they are carved out of large zeroed blocks and never freed one by one.
+ */
+#define	ARENA_BLOCK	65536
+#define	ARENA_ALIGN	sizeof(double)
+
+static char *arena_next, *arena_end;
+
+void *arena_alloc(size_t size)
+{
+	void *p;
+
+	size = (size + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+	if (size > ARENA_BLOCK/4) return calloc_or_die(1, size);
+	if (arena_next == NULL || size > arena_end - arena_next) {
+		arena_next = calloc_or_die(1, ARENA_BLOCK);
+		arena_end = arena_next + ARENA_BLOCK;
+	}
+	p = arena_next;
+	arena_next += size;
+	return p;
+}
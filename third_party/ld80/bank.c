@@ -0,0 +1,244 @@
+/*
+ * Banked code. Code sections read after -B name are placed one after the
+ * other in that bank's address range, which other banks may share, and
+ * are written to the bank's own file rather than the image. A CALL or JP
+ * to a public symbol in another bank is pointed at a stub made from the
+ * --bank-stub template, which switches banks on the way; the stubs all
+ * go in one code section after the others.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "ld80.h"
+
+struct bank banks[MAX_BANKS];
+int bank_cnt;
+
+/* --bank-stub: bytes, the target's bank, the target and public symbols */
+#define	MAX_STUB	32
+static struct stubpart {
+	int kind;
+#	define	SP_BYTE		0
+#	define	SP_BANK		1
+#	define	SP_TARGET	2
+#	define	SP_SYMBOL	3
+	int byte;
+	char name[NAMELEN+1];
+} stubparts[MAX_STUB];
+static int stubpart_cnt, stub_len = -1;
+
+/* --bank NAME,ID,START,END,FILE */
+int add_bank(char *spec)
+{
+	struct bank *b;
+	char *p, *q;
+
+	if (bank_cnt == MAX_BANKS) die(E_USAGE, "ld80: Too many banks\n");
+	b = banks + bank_cnt;
+
+	if ((p = strchr(spec, ',')) == NULL || p == spec ||
+			p - spec > NAMELEN) return 0;
+	memcpy(b->name, spec, p - spec);
+	b->name[p - spec] = '\0';
+	if (find_bank(b->name)) die(E_USAGE,
+		"ld80: Bank %s is defined twice\n", b->name);
+	b->id = strtoul(q = p+1, &p, 16);
+	if (p == q || *p++ != ',') return 0;
+	b->start = strtoul(q = p, &p, 16);
+	if (p == q || *p++ != ',') return 0;
+	b->end = strtoul(q = p, &p, 16);
+	if (p == q || *p++ != ',' || !*p) return 0;
+	b->filename = p;
+
+	if (b->id > 0xff) die(E_USAGE,
+		"ld80: Bank number %x is out of range\n", b->id);
+	if (b->start > 0xffff || b->end > 0xffff) die(E_USAGE,
+		"ld80: Address %x is out of range\n",
+		b->start > 0xffff ? b->start : b->end);
+	if (b->end < b->start) return 0;
+	b->image = calloc_or_die(b->end - b->start + 1, 1);
+	bank_cnt++;
+	return 1;
+}
+
+struct bank *find_bank(char *name)
+{
+	struct bank *b;
+
+	for (b=banks; b<banks+bank_cnt; b++)
+		if (!strcmp(b->name, name)) return b;
+	return NULL;
+}
+
+/*
+ * The template is a comma separated list of bytes as two hex digits,
+ * %bank for the target's bank number, %target for its address and
+ * public symbols for theirs.
+ */
+int set_bank_stub(char *spec)
+{
+	struct stubpart *sp;
+	char *p, *q, *end;
+	int len;
+
+	stubpart_cnt = 0;
+	stub_len = 0;
+	for (p=spec; *p; p=end) {
+		if (stubpart_cnt == MAX_STUB) return 0;
+		sp = stubparts + stubpart_cnt++;
+		end = strchr(p, ',');
+		len = end ? end - p : strlen(p);
+		if (len == 0 || len > NAMELEN) return 0;
+		if (len == 2 && isxdigit(p[0]) && isxdigit(p[1])) {
+			sp->kind = SP_BYTE;
+			sp->byte = strtoul(p, NULL, 16);
+			stub_len++;
+		}
+		else if (len == 5 && !strncmp(p, "%bank", 5)) {
+			sp->kind = SP_BANK;
+			stub_len++;
+		}
+		else if (len == 7 && !strncmp(p, "%target", 7)) {
+			sp->kind = SP_TARGET;
+			stub_len += 2;
+		}
+		else {
+			sp->kind = SP_SYMBOL;
+			memcpy(sp->name, p, len);
+			sp->name[len] = '\0';
+			for (q=sp->name; *q; q++) *q = toupper(*q);
+			stub_len += 2;
+		}
+		end = end ? end+1 : p + strlen(p);
+	}
+	return stub_len > 0;
+}
+
+static
+int is_call_or_jump(int opcode)
+{
+	return opcode == 0xcd || opcode == 0xc3 ||
+		(opcode & 0xc7) == 0xc4 ||	/* CALL cc */
+		(opcode & 0xc7) == 0xc2;	/* JP cc */
+}
+
+static
+struct bank *bank_of(struct symbol *s)
+{
+	return s->at.section ? s->at.section->bank : NULL;
+}
+
+/*
+ * Each external reference is a run of nodes at one offset; the ones
+ * which can go through a stub are [N_EXTERNAL, N_WORD] after a CALL or
+ * JP opcode. Calls whose symbol needs a stub are given one, and are
+ * pointed at it once the stub section exists. Returns the number of
+ * stubs.
+ */
+static
+int find_stubs(struct section *stubsec, struct symbol ***stubv, int *stub_max)
+{
+	struct segment *segp;
+	struct section *sp;
+	struct node *n, *end;
+	struct bank *b;
+	int k, cnt = 0;
+
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+			for (sp=segp->secs; sp; sp=sp->next) {
+		if (sp == stubsec) continue;
+		sort_nodes(sp);
+		for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n=end) {
+			for (end=n; end<sp->nodes+sp->node_cnt &&
+				end->at.offset==n->at.offset; end++)
+				/* EMPTY */;
+			for (k=0; n+k<end && n[k].type!=N_EXTERNAL; k++)
+				/* EMPTY */;
+			if (n+k == end) continue;
+			b = bank_of(n[k].symbol);
+			if (b == NULL || b == sp->bank) continue;
+
+			if (end-n != 2 || k != 0 || n[1].type != N_WORD ||
+					n->at.offset < 1 ||
+					!is_call_or_jump(sp->buffer[n->at.offset-1])) {
+				if (stubsec == NULL) fprintf(stderr,
+					"ld80: Warning: %s in module %s refers "
+					"to bank %s without a stub\n",
+					n[k].symbol->name, sp->module_name,
+					b->name);
+				continue;
+			}
+			if (stub_len < 0) die(E_USAGE,
+				"ld80: Module %s calls %s in bank %s, "
+				"but there is no --bank-stub\n",
+				sp->module_name, n->symbol->name, b->name);
+
+			if (stubsec) {
+				n->type = N_OPERAND;
+				n->at.section = stubsec;
+				n->value = (n->symbol->stub-1) * stub_len;
+				n->symbol = NULL;
+				continue;
+			}
+			if (n->symbol->stub) continue;
+			if (cnt == *stub_max) {
+				*stub_max = *stub_max ? *stub_max*2 : 64;
+				*stubv = realloc(*stubv,
+					*stub_max * sizeof(**stubv));
+				if (*stubv == NULL) die(E_RESOURCE,
+					"ld80: not enough memory\n");
+			}
+			(*stubv)[cnt++] = n->symbol;
+			n->symbol->stub = cnt;
+		}
+	}
+	return cnt;
+}
+
+/*
+ * Makes the stubs for calls between banks. Reports what it made on
+ * report, if that isn't NULL. Returns the number of bytes they take.
+ */
+int make_stubs(FILE *report)
+{
+	struct symbol **stubv = NULL;
+	struct section *stubsec;
+	struct stubpart *p;
+	struct node *n;
+	int i, cnt, stub_max = 0, offset;
+
+	if (bank_cnt == 0) return 0;
+	cnt = find_stubs(NULL, &stubv, &stub_max);
+	if (cnt == 0) {
+		free(stubv);
+		return 0;
+	}
+
+	stubsec = add_code_section("STUBS", cnt * stub_len);
+	for (i=0, offset=0; i<cnt; i++) {
+		for (p=stubparts; p<stubparts+stubpart_cnt; p++) {
+			switch (p->kind) {
+			case SP_BYTE:
+				stubsec->buffer[offset++] = p->byte;
+				continue;
+			case SP_BANK:
+				stubsec->buffer[offset++] =
+					bank_of(stubv[i])->id;
+				continue;
+			}
+			n = add_node(stubsec, offset, N_EXTERNAL);
+			n->symbol = p->kind == SP_TARGET ? stubv[i] :
+				find_symbol(p->name);
+			add_node(stubsec, offset, N_WORD);
+			offset += 2;
+		}
+	}
+	stubsec->lc = offset;
+	find_stubs(stubsec, &stubv, &stub_max);
+	free(stubv);
+
+	if (report) fprintf(report, "Made %d bank stubs, %d bytes\n",
+		cnt, cnt * stub_len);
+	return cnt * stub_len;
+}
@@ -7,7 +7,32 @@ cprogram {
         "./symbol.c",
         "./fixup.c",
         "./do_out.c",
-        "./optget.c"
+        "./optget.c",
+        "./arena.c",
+        "./relax.c",
+        "./bank.c",
+        "./place.c"
+    },
+    vars = {
+        ["+ldflags"] = { "-lpthread" }
+    }
+}
+
+cprogram {
+    name = "lib80",
+    srcs = {
+        "./lib80.c",
+        "./readobj.c",
+        "./section.c",
+        "./symbol.c",
+        "./fixup.c",
+        "./optget.c",
+        "./arena.c",
+        "./relax.c",
+        "./bank.c"
+    },
+    vars = {
+        ["+ldflags"] = { "-lpthread" }
     }
 }
 
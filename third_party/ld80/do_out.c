@@ -201,3 +201,40 @@ int do_out(FILE *f, int oformat, int entry_point)
 	return 0;
 }
 
+
+/*
+ * Writes addresses start to end, inclusive, as a raw binary; end < 0
+ * means the end of the image, as do_out() would write it. Addresses
+ * nothing was loaded at are filled as the gaps are.
+ */
+int do_window(FILE *f, int oformat, int start, int end)
+{
+	int addr, len;
+	extern unsigned char *aseg;
+
+	if (end < 0)
+		for (end=0xffff; end>=0 && !MARKED(end); end--) /* EMPTY */;
+
+	for (addr=start; addr<=end; addr+=len) {
+		if (MARKED(addr)) {
+			len = marked_len(addr);
+			if (len > end-addr+1) len = end-addr+1;
+			write_block(f, aseg+addr, addr, len, oformat);
+		}
+		else {
+			len = unmarked_len(addr);
+			if (len > end-addr+1) len = end-addr+1;
+			write_gap(f, len, oformat);
+		}
+	}
+	return 0;
+}
+
+/* Writes what was placed in bank b, from its start. */
+int do_bank(FILE *f, int oformat, struct bank *b)
+{
+	if (b->loc > b->start)
+		write_block(f, b->image, b->start, b->loc - b->start, oformat);
+	finalize_out(f, oformat, -1);
+	return 0;
+}
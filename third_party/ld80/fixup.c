@@ -4,15 +4,42 @@
 #include "ld80.h"
 
 int undefined = 0;
-int nodenum = 0;
 static struct node *tos;
 
 static void push(struct node *);
 static struct node *pop(void);
 
+/*
+ * Fixups are also hashed by lc, so that external chains (which are
+ * threaded through them) can be followed in constant time per link.
+ * Each bucket holds the newest fixups first, like the fixups list.
+ */
+#define	FIXHASH(sp, lc)	((sp)->fixhash + ((lc) & ((sp)->fixhash_size-1)))
+
+static
+void grow_fixhash(struct section *sp)
+{
+	int i, size = sp->fixhash_size ? sp->fixhash_size*2 : 64;
+	struct fixup **oldhash = sp->fixhash, *f, **tail;
+
+	sp->fixhash = calloc_or_die(size, sizeof(*sp->fixhash));
+	sp->fixhash_size = size;
+	for (i=0; i<size/2 && oldhash; i++) {
+		while ((f = oldhash[i]) != NULL) {	/* keep bucket order */
+			oldhash[i] = f->hnext;
+			for (tail=FIXHASH(sp, f->lc); *tail; tail=&(*tail)->hnext)
+				/* EMPTY */;
+			f->hnext = NULL;
+			*tail = f;
+		}
+	}
+	free(oldhash);
+}
+
 void add_fixup(struct section *loc, struct section *target, int offset)
 {
-	struct fixup *f = calloc_or_die(1, sizeof(*f));
+	struct fixup *f = arena_alloc(sizeof(*f));
+	struct fixup **h;
 
 	f->lc = loc->lc;
 	f->at.section = target;
@@ -23,6 +50,11 @@ void add_fixup(struct section *loc, struct section *target, int offset)
 #endif
 	f->next = loc->fixups;
 	loc->fixups = f;
+
+	if (loc->fixup_cnt++ >= loc->fixhash_size) grow_fixhash(loc);
+	h = FIXHASH(loc, f->lc);
+	f->hnext = *h;
+	*h = f;
 }
 
 static
@@ -30,25 +62,48 @@ struct fixup *get_fixup(int lc, struct section *section)
 {
 	struct fixup **fpp, *fp;
 
-	/* linear search on fixup chain */
-	for (fpp=&section->fixups, fp=*fpp; fp; fpp=&fp->next,fp=fp->next) {
+	if (section->fixhash == NULL) return NULL;
+	for (fpp=FIXHASH(section, lc); (fp=*fpp); fpp=&fp->hnext) {
 		if (fp->lc == lc) break;	/* gotcha */
 	}
-	if (*fpp == NULL) return NULL;		/* not found */
-	*fpp = fp->next;			/* remove from chain */
+	if (fp == NULL) return NULL;		/* not found */
+	*fpp = fp->hnext;			/* remove from bucket */
+	fp->lc = -1;		/* set_fixups() will skip it */
 	return fp;
 }
 
+/* Like get_fixup(), but leaves the fixup where it is. */
+struct fixup *find_fixup(struct section *section, int lc)
+{
+	struct fixup *fp;
+
+	if (section->fixhash == NULL) return NULL;
+	for (fp=*FIXHASH(section, lc); fp; fp=fp->hnext)
+		if (fp->lc == lc) return fp;
+	return NULL;
+}
+
+/*
+ * Nodes are kept in an array per section, in the order they are added;
+ * sort_nodes() then moves each offset's nodes together. The pointer
+ * returned is only good until the next add_node() on the section.
+ */
 struct node *add_node(struct section *section, int offset, int type)
 {
-	struct node *n = calloc_or_die(1, sizeof(*n));
+	struct node *n;
 
-	if (section->nodetail) section->nodetail->next = n;
-	else section->nodehead = n;
-	section->nodetail = n;
+	if (section->node_cnt == section->node_max) {
+		section->node_max = section->node_max ?
+			section->node_max*2 : 64;
+		section->nodes = realloc(section->nodes,
+			section->node_max * sizeof(*section->nodes));
+		if (section->nodes == NULL) die(E_RESOURCE,
+			"ld80: not enough memory\n");
+	}
+	n = section->nodes + section->node_cnt++;
+	memset(n, 0, sizeof(*n));
 	n->at.offset = offset;
 	n->type = type;
-	n->nodenum = nodenum++;
 	return n;
 }
 
@@ -71,7 +126,6 @@ void convert_chain_to_nodes(char *name, int offset, struct section *section)
 		if (f==NULL) break;	/* end of chain */
 		offset = f->at.offset;
 		section = f->at.section;
-		free(f);
 	}
 }
 
@@ -79,12 +133,13 @@ void set_fixups(void)
 {
 	struct segment *segp;
 	struct section *sp;
-	struct fixup *f, *ff;
+	struct fixup *f;
 	unsigned char *p;
 
 	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++) {
 		for (sp=segp->secs; sp; sp=sp->next) {/* all sections */
-			for (f=sp->fixups; f; ff=f, f=f->next, free(ff)) {
+			for (f=sp->fixups; f; f=f->next) {
+				if (f->lc < 0) continue;	/* chain link */
 				p = sp->buffer + f->lc;
 				*((unsigned short *)p) = (unsigned short)
 					(f->at.section->base + f->at.offset);
@@ -95,6 +150,9 @@ void set_fixups(void)
 					f->at.section->base + f->at.offset);
 #endif
 			}
+			sp->fixups = NULL;
+			free(sp->fixhash);
+			sp->fixhash = NULL;
 		}
 	}
 }
@@ -108,7 +166,7 @@ void resolve_externals(void)
 
 	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++) {
 		for (sp=segp->secs; sp; sp=sp->next) {/* all sections */
-			for (n=sp->nodehead; n; n=n->next) {
+			for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++) {
 				if (n->type != N_EXTERNAL) continue;
 				n->type = N_OPERAND;
 				s=get_symbol(n->symbol->name);
@@ -133,36 +191,33 @@ void resolve_externals(void)
 	
 }
 
-#define NODE(x)  (*((struct node **)(x)))
-
-static
-int by_offset(const void *a, const void *b)
-{
-	int i;
-	i = NODE(a)->at.offset - NODE(b)->at.offset;
-	if (i) return i;
-	return NODE(a)->nodenum - NODE(b)->nodenum;
-}
-
-static
+/*
+ * Puts the nodes of a section in offset order, keeping the order they
+ * were added in for each offset. Offsets are bounded by the section
+ * length, so this is a counting sort.
+ */
 void sort_nodes(struct section *sp)
 {
-	int i,nodeno;
-	struct node *n, **nlist;
-
-	for (nodeno=0,n=sp->nodehead; n; n=n->next) nodeno++;
-	if (nodeno==0) return;
-
-	nlist = calloc_or_die(nodeno, sizeof(*nlist));
-	for (i=0,n=sp->nodehead; n; n=n->next, i++) nlist[i] = n;
-	qsort((void*)nlist, nodeno, sizeof(*nlist), by_offset);
-	for (i=0; i<(nodeno-1); i++) nlist[i]->next = nlist[i+1];
-	nlist[nodeno-1]->next = NULL;
-
-	sp->nodehead = nlist[0];
-	sp->nodetail = nlist[nodeno-1];
-	free(nlist);
-	return;
+	int i, maxoffset = 0, *first;
+	struct node *n, *sorted;
+
+	if (sp->node_cnt == 0) return;
+
+	for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++)
+		if (maxoffset < n->at.offset) maxoffset = n->at.offset;
+	first = calloc_or_die(maxoffset+2, sizeof(*first));
+	for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++)
+		first[n->at.offset+1]++;
+	for (i=1; i<=maxoffset+1; i++) first[i] += first[i-1];
+
+	sorted = calloc_or_die(sp->node_cnt, sizeof(*sorted));
+	for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++)
+		sorted[first[n->at.offset]++] = *n;
+
+	free(first);
+	free(sp->nodes);
+	sp->nodes = sorted;
+	sp->node_max = sp->node_cnt;
 }
 
 void process_nodes(void)
@@ -171,13 +226,14 @@ void process_nodes(void)
 	struct section *sp;
 	struct node *n;
 	void *p;
+	int i;
 
 	/* nested for cycles get all sections */
 	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
 			for (sp=segp->secs; sp; sp=sp->next) {
 		sort_nodes(sp);
-		while ((n=sp->nodehead) != NULL) { /* get all nodes */
-			sp->nodehead = n->next;
+		for (i=0; i<sp->node_cnt; i++) { /* get all nodes */
+			n = sp->nodes + i;
 //printf("  node: offset=%.4x type=%d value=%.4x name=%s\n",
 //n->at.offset, n->type, n->value, n->symbol ? n->symbol->name : "");
 			switch (n->type) {
@@ -189,13 +245,9 @@ void process_nodes(void)
 					tos->value += n->value;
 					tos->type = N_OPERAND;
 				}
-				else {
-					push(n);
-					n = NULL;
-				}
+				else push(n);
 				break;
 			case N_BYTE:
-				free(n);
 				n = pop();
 				p = sp->buffer + n->at.offset; /* cast removal needed for mac, too */
 #ifdef DEBUG
@@ -206,7 +258,6 @@ void process_nodes(void)
 				*((unsigned char*)p) = n->value;
 				break;
 			case N_WORD:
-				free(n);
 				n = pop();
 				p = sp->buffer + n->at.offset; /* cast removal needed for mac, too */
 #ifdef DEBUG
@@ -229,27 +280,22 @@ void process_nodes(void)
 				tos->value &= 0xff;
 				break;
 			case N_PLUS:
-				free(n);
 				n = pop();
 				tos->value += n->value;
 				break;
 			case N_MINUS:
-				free(n);
 				n = pop();
 				tos->value -= n->value;
 				break;
 			case N_MULT:
-				free(n);
 				n = pop();
 				tos->value *= n->value;
 				break;
 			case N_DIV:
-				free(n);
 				n = pop();
 				tos->value /= n->value;
 				break;
 			case N_MOD:
-				free(n);
 				n = pop();
 				tos->value %= n->value;
 				break;
@@ -262,7 +308,6 @@ void process_nodes(void)
 					n->type = N_EXTPLUS;
 				}
 				push(n);
-				n = NULL;
 				break;
 			case N_EXTERNAL:
 				die(E_INPUT,
@@ -271,16 +316,18 @@ void process_nodes(void)
 				die(E_INPUT, "ld80: Unknown node type %d\n",
 					n->type);
 			} /* switch */
-			if (n) free(n);
 //if (tos) printf("tos: at=%p:%.4x type=%d value=%.4x symbol=%s\n", tos->at.section,
 //tos->at.offset, tos->type, tos->value, tos->symbol ? tos->symbol->name : "");
 //else printf("empty\n");
-		} /* while */
+		} /* for */
 		if (tos) {
 			die(E_INPUT,"ld80: Expression evaluation error\n");
 //printf("tos: at=%p:%.4x type=%d value=%.4x symbol=%s\n", tos->at.section,
 //tos->at.offset, tos->type, tos->value, tos->symbol ? tos->symbol->name : "");
 		}
+		free(sp->nodes);
+		sp->nodes = NULL;
+		sp->node_cnt = sp->node_max = 0;
 	} /* for for */
 }
 
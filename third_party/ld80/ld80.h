@@ -63,7 +63,8 @@ struct loc {
 
 struct fixup {
 	struct fixup *next;
-	int lc;
+	struct fixup *hnext;	/* next in fixhash bucket */
+	int lc;		/* -1 = consumed by an external chain */
 	struct loc at;
 };
 
@@ -75,9 +76,19 @@ struct section {
 	int len;	/* final lc - start */
 	char *filename;
 	struct fixup *fixups;
-	struct node *nodehead, *nodetail;
+	struct fixup **fixhash;	/* fixups hashed by lc */
+	int fixhash_size, fixup_cnt;
+	struct node *nodes;	/* in offset order after sort_nodes() */
+	int node_cnt, node_max;
 	char module_name[NAMELEN+1];
 	struct segment *segment;
+	int fixed;	/* base was given with -P, -D or -C */
+	int align;	/* from -P %xx, -D %xx or -C name,%xx */
+	int reachable;	/* for gc_sections() */
+	int removed;	/* dropped by gc_sections() */
+	struct relax *relaxes;	/* in lc order after relax_sections() */
+	int relax_cnt, relax_max, relax_shrunk;
+	struct bank *bank;	/* NULL unless placed in a bank with -B */
 };
 
 struct segment {
@@ -86,6 +97,7 @@ struct segment {
 	int default_base;
 	int uncommon;
 	int maxsize;
+	int base_given;	/* default_base was set by set_base_address() */
 	char common_name[NAMELEN+1];
 };
 
@@ -93,13 +105,39 @@ struct symbol {
 	struct loc at;
 	int value;
 #define	UNDEFINED	(-1)
+	int stub;	/* 1 + index of its bank stub, 0 if none */
 	char name[NAMELEN+1];
 };
 
+#define	MAX_BANKS	16
+struct bank {
+	char name[NAMELEN+1];
+	int id;		/* for the %bank of a stub */
+	int start, end;
+	int loc;	/* next free address, while placing sections */
+	char *filename;
+	unsigned char *image;
+};
+
+struct relax {
+	int lc;		/* of the opcode */
+	int kind;
+#	define	R_JP		'R'	/* JP or JP cc, may become JR */
+#	define	R_JR		'J'	/* JR or DJNZ to follow the code */
+	int state;
+#	define	R_KEEP		0
+#	define	R_SHRINK	1
+#	define	R_PINNED	2	/* shrunk once, then out of range */
+	int before;	/* R_SHRINK entries before this one */
+	int disp;
+	struct loc target;	/* R_JP; section is NULL if absolute */
+	struct fixup *fixup;	/* R_JP operand, if relocatable */
+	int node, nodes;	/* R_JP operand expression, if external */
+};
+
 struct node {
-	struct node *next;
+	struct node *next;	/* expression stack */
 	struct loc at;
-	int nodenum;
 	int type;
 #	define	N_OPERAND	0
 #	define	N_BYTE		1
@@ -123,6 +161,8 @@ struct node {
 extern int warn_extchain, debug;
 extern int fatalerror;
 extern struct segment *segv;
+extern struct bank banks[];
+extern int bank_cnt;
 extern unsigned char usage_map[];
 #define MARK_BYTE(a)	usage_map[(a)/8] |= 1 << ((a)%8)
 #define MARKED(a)	(usage_map[(a)/8] & 1 << ((a)%8))
@@ -135,12 +175,22 @@ extern unsigned char usage_map[];
 
 void die(int, const char*, ...) __attribute__ ((__noreturn__));
 void *calloc_or_die(size_t, size_t);
+void *arena_alloc(size_t);
 
 int read_object_file(char *, int);
+void queue_object_file(char *);
+void decode_object_files(int);
+int write_library_index(char *, FILE *);
+#define LIBINDEX_SUFFIX	".idx"
 
 void set_base_address(int, char *, int, int);
+void set_bank(struct bank *);
+struct section *add_code_section(char *, int);
 void mark_uncommon(char *);
 void add_item(struct object_item *, char *);
+struct section *main_section(void);
+int gc_sections(char **, int, FILE *);
+void pack_sections(void);
 void relocate_sections(void);
 void dump_sections(void);
 void init_section(void);
@@ -150,11 +200,13 @@ void print_map(FILE *);
 struct symbol *find_symbol(char *);
 int add_symbol(char *, int, struct section *);
 struct symbol *get_symbol(char *);
-int init_symbol(int);
+void init_symbol(void);
 void clear_symbol(void);
 void dump_symbols(void);
 void set_symbols(void);
+void shift_symbols(int (*)(struct section *, int));
 void print_symbol_table(FILE *);
+void write_symbol_table(FILE *, FILE *);
 
 void add_fixup(struct section *, struct section *, int);
 void set_fixups(void);
@@ -162,26 +214,34 @@ void resolve_externals(void);
 void convert_chain_to_nodes(char *, int, struct section *);
 void process_nodes(void);
 struct node *add_node(struct section *, int, int);
+struct fixup *find_fixup(struct section *, int);
+void sort_nodes(struct section *);
 
-int do_out(FILE *, int, int);
+int add_region(char *);
+int add_order(char *);
+int place_sections(FILE *);
 
-extern int optget_ind;
-extern int optget(int argc, char **argv, char *options, char **arg);
-
-#ifdef NEED_HSEARCH
+int add_bank(char *);
+struct bank *find_bank(char *);
+int set_bank_stub(char *);
+int make_stubs(FILE *);
 
-typedef struct {
-	char *key;
-	void *data;
-} ENTRY;
+void add_relax(struct section *, int);
+int relax_sections(FILE *);
 
-typedef enum { ENTER, FIND } ACTION;
+int do_out(FILE *, int, int);
+int do_window(FILE *, int, int, int);
+int do_bank(FILE *, int, struct bank *);
 
-extern int hcreate(size_t);
-extern ENTRY *hsearch(ENTRY item, ACTION action);
-extern void hdestroy();
+struct longopt {
+	char *name;
+	int has_arg;
+	int val;	/* returned by optget(); keep clear of option letters */
+};
 
-#endif
+extern int optget_ind;
+extern struct longopt *optget_longopts;
+extern int optget(int argc, char **argv, char *options, char **arg);
 
 #ifdef WINHACK
 
@@ -0,0 +1,102 @@
+/*
+ * lib80 - writes the index ld80 uses to search a library without
+ * decoding every module in it. The library itself is left alone.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#ifndef WINHACK
+#include <unistd.h>
+#endif
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include "ld80.h"
+
+/* readobj.c shares these with the rest of the linker */
+int warn_extchain, debug;
+int fatalerror;
+static char *ofilename;
+
+void usage(void);
+
+int main(int argc, char **argv)
+{
+	int c, n;
+	char *optarg;
+	char *libname = NULL;
+	FILE *ofile;
+
+	while ((c = optget (argc, argv, "o:vhV", &optarg)) != -1) switch (c) {
+	case 1:		/* Library */
+		if (libname) {
+			usage();
+			die(E_USAGE, "");
+		}
+		libname = optarg;
+		break;
+	case 'o':	/* Index file */
+		ofilename = optarg;
+		break;
+	case 'v':	/* Verbose */
+		debug++;
+		break;
+	case 'V':	/* Version */
+		die(E_USAGE, "lib80 v%s\n", VERSION);
+	default:
+	case 'h':	/* Help */
+		usage();
+		die(E_USAGE, "");
+	}
+	if (!libname) {
+		usage();
+		die(E_USAGE, "");
+	}
+
+	if (!ofilename) {
+		ofilename = calloc_or_die(strlen(libname)+
+			sizeof(LIBINDEX_SUFFIX), 1);
+		sprintf(ofilename, "%s%s", libname, LIBINDEX_SUFFIX);
+	}
+	if ((ofile=fopen(ofilename,"w")) == NULL) die(E_USAGE,
+		"lib80: Cannot open index file %s: %s\n",
+		ofilename, strerror(errno));
+
+	init_symbol();
+	n = write_library_index(libname, ofile);
+	if (fclose(ofile)) die(E_RESOURCE,
+		"lib80: Cannot write index file %s: %s\n",
+		ofilename, strerror(errno));
+	if (debug) printf("%s: %d modules\n", libname, n);
+
+	clear_symbol();
+	return E_SUCCESS;
+}
+
+void *calloc_or_die(size_t nmemb, size_t size)
+{
+	void *retval = calloc(nmemb, size);
+	if (retval==NULL) die(E_RESOURCE,"lib80: not enough memory\n");
+	return retval;
+}
+
+void usage(void)
+{
+	fprintf(stderr,
+"Usage:\n"
+"lib80 [-vV] [-o indexfile] library\n"
+"where indexfile defaults to the library name plus " LIBINDEX_SUFFIX "\n"
+	);
+}
+
+void die(int status, const char *format, ...)
+{
+	va_list arg;
+
+	fflush(stdout);
+	va_start(arg, format);
+	vfprintf(stderr, format, arg);
+	va_end(arg);
+
+	if (status && ofilename) unlink(ofilename);
+	exit(status);
+}
@@ -11,10 +11,51 @@
 
 int warn_extchain, debug;
 static char *ofilename, *symfilename;
+static char *symbinname, *symjsonname;
 int fatalerror;
 
+/* long options */
+#define	OPT_WINDOW	256
+#define	OPT_GC_SECTIONS	257
+#define	OPT_KEEP	258
+#define	OPT_RELAX	259
+#define	OPT_SERIAL	260
+#define	OPT_BANK	261
+#define	OPT_BANK_STUB	262
+#define	OPT_PACK	263
+#define	OPT_ORDER	264
+#define	OPT_SYM_BIN	265
+#define	OPT_SYM_JSON	266
+
+static struct longopt longopts[] = {
+	{ "window",	1,	OPT_WINDOW },
+	{ "gc-sections",0,	OPT_GC_SECTIONS },
+	{ "keep",	1,	OPT_KEEP },
+	{ "relax",	0,	OPT_RELAX },
+	{ "serial",	0,	OPT_SERIAL },
+	{ "bank",	1,	OPT_BANK },
+	{ "bank-stub",	1,	OPT_BANK_STUB },
+	{ "pack",	1,	OPT_PACK },
+	{ "order",	1,	OPT_ORDER },
+	{ "sym-bin",	1,	OPT_SYM_BIN },
+	{ "sym-json",	1,	OPT_SYM_JSON },
+	{ NULL,		0,	0 }
+};
+
+/* --window START:[END][,FILE] */
+#define	MAX_WINDOWS	16
+static struct window {
+	int start, end;		/* end < 0 means the end of the image */
+	char *filename;		/* NULL means the output file */
+} windows[MAX_WINDOWS];
+static int window_cnt, ofile_window_cnt;
+
 void usage(void);
 int setformat(char *name, int *format);
+int add_window(char *spec);
+void write_windows(FILE *ofile, int oformat);
+void write_banks(int oformat);
+void write_symbol_tables(void);
 
 int main(int argc,char **argv)
 {
@@ -23,7 +64,6 @@ int main(int argc,char **argv)
 	int suppress_data = 0;
 	int oformat = F_IHEX;
 	FILE *ofile, *symfile=NULL;
-	int symsize = 32768;
 	int entry_point = -1;
 	char *entry_name = NULL;
 	int argc2 = 1;
@@ -31,6 +71,9 @@ int main(int argc,char **argv)
 	int abort = 0;
 	int lib = 0;
 	int symbol_table_required = 0, map_required = 0;
+	int gc = 0, relax = 0, serial = 0, pack = 0;
+	char **roots;
+	int nroots = 0;
 	char *common_name = "COMMON";
 	char *optarg;
 	char *tmp;
@@ -45,17 +88,21 @@ int main(int argc,char **argv)
 	 */
 	argv2 = calloc_or_die(argc*2+1, sizeof(*argv2));
 	argc2=1;
+	roots = calloc_or_die(argc+1, sizeof(*roots));
 
-#define	REGULAR_OPTSTRING	"VlP:D:C:U:E:O:o:hcs:mS:W:"
+#define	REGULAR_OPTSTRING	"VlP:D:C:B:U:E:O:o:hcs:mS:W:"
 #ifdef	DEBUG
 #define	OPTSTRING		REGULAR_OPTSTRING "d"
 #else
 #define	OPTSTRING		REGULAR_OPTSTRING
 #endif
 
+	optget_longopts = longopts;
 	while ((c = optget (argc, argv, OPTSTRING, &optarg)) != -1) switch (c) {
 	case 1:		/* Input file */
 		argv2[argc2++] = optarg;	/* defer processing */
+		if (!lib) queue_object_file(optarg);
+		lib = 0;
 		break;
 	case 'P':	/* Program location */
 		argv2[argc2++] = "-P";
@@ -69,8 +116,13 @@ int main(int argc,char **argv)
 		argv2[argc2++] = "-C";
 		argv2[argc2++] = optarg;	/* defer processing */
 		break;
+	case 'B':	/* Bank for code */
+		argv2[argc2++] = "-B";
+		argv2[argc2++] = optarg;	/* defer processing */
+		break;
 	case 'l':	/* Library specification */
 		argv2[argc2++] = "-l";		/* defer processing */
+		lib = 1;
 		break;
 
 	case 'U':	/* "Uncommon" segment */
@@ -78,14 +130,7 @@ int main(int argc,char **argv)
 		{ char *s; for (s=optarg; *s; s++) *s = toupper(*s); }
 		mark_uncommon(optarg);
 		break;
-	case 'S':	/* Set symbol table size */
-		n = atoi(optarg);
-		if (n<=0) {
-			fprintf(stderr,"ld80: symbol table size is invalid\n");
-			abort = 1;
-			break;
-		}
-		if (symsize<n) symsize = n;
+	case 'S':	/* Symbol table size: no longer needed */
 		break;
 	case 'o':	/* Output file */
 		ofilename = optarg;
@@ -102,6 +147,56 @@ int main(int argc,char **argv)
 	case 'c':	/* Suppress data segments */
 		suppress_data++;
 		break;
+	case OPT_WINDOW:	/* Write part of the image */
+		if (!add_window(optarg)) {
+			usage();
+			abort = 1;
+		}
+		break;
+	case OPT_GC_SECTIONS:	/* Drop unreferenced sections */
+		gc++;
+		break;
+	case OPT_KEEP:	/* Root for --gc-sections */
+		{ char *s; for (s=optarg; *s; s++) *s = toupper(*s); }
+		roots[nroots++] = optarg;
+		break;
+	case OPT_RELAX:	/* Shrink jumps marked by zmac --relax */
+		relax++;
+		break;
+	case OPT_SERIAL:	/* Decode one file at a time */
+		serial++;
+		break;
+	case OPT_PACK:	/* Region to pack sections into */
+		if (!add_region(optarg)) {
+			usage();
+			abort = 1;
+		}
+		pack++;
+		break;
+	case OPT_ORDER:	/* Modules --pack must keep in order */
+		if (!add_order(optarg)) {
+			usage();
+			abort = 1;
+		}
+		break;
+	case OPT_SYM_BIN:	/* Address ordered symbol table */
+		symbinname = optarg;
+		break;
+	case OPT_SYM_JSON:	/* The same as JSON */
+		symjsonname = optarg;
+		break;
+	case OPT_BANK:	/* Address range for banked code */
+		if (!add_bank(optarg)) {
+			usage();
+			abort = 1;
+		}
+		break;
+	case OPT_BANK_STUB:	/* Template for calls between banks */
+		if (!set_bank_stub(optarg)) {
+			usage();
+			abort = 1;
+		}
+		break;
 	case 'W':	/* Warnings */
 		if (!strcmp(optarg,"extchain")) warn_extchain++;
 		else {
@@ -118,6 +213,8 @@ int main(int argc,char **argv)
 		}
 		else {
 			entry_name = optarg;
+			{ char *s; for (s=optarg; *s; s++) *s = toupper(*s); }
+			roots[nroots++] = optarg;
 		}
 		break;
 	case 's':	/* Symbol table */
@@ -155,18 +252,34 @@ int main(int argc,char **argv)
 				symfilename, strerror(errno));
 		}
 	}
+	if (window_cnt && oformat != F_BIN00 && oformat != F_BINFF) {
+		fprintf(stderr,"ld80: --window needs bin or binff output\n");
+		abort = 1;
+	}
+	if (pack && relax) {
+		fprintf(stderr,"ld80: --pack and --relax can't be used together\n");
+		abort = 1;
+	}
 	if (abort) die(E_USAGE,"");
+	lib = 0;
 
 	/*
 	 * Start processing object files.
 	 */
-	init_symbol(symsize);
+	if (!serial) decode_object_files(0);
+	init_symbol();
 
 	optget_ind = 0;	/* make reinitialize optget() */
-	while ((c = optget (argc2, argv2, "lD:P:C:", &optarg)) != -1) switch (c) {
+	optget_longopts = NULL;
+	while ((c = optget (argc2, argv2, "lD:P:C:B:", &optarg)) != -1) switch (c) {
 	case 'l':	/* Library to search in */
 		lib = 1;
 		break;
+	case 'B':	/* Bank for code */
+		if (!strcmp(optarg, "-")) set_bank(NULL);
+		else if (find_bank(optarg)) set_bank(find_bank(optarg));
+		else die(E_USAGE, "ld80: No bank %s\n", optarg);
+		break;
 	case 'C':	/* Common location */
 		common_name = optarg;
 		for (/*EMPTY*/; *optarg && *optarg!=','; optarg++)
@@ -207,8 +320,17 @@ int main(int argc,char **argv)
 #else
 #define	IFDEBUG(x)
 #endif
+	if (gc) {
+		IFDEBUG( printf("\nRemoving unreferenced sections\n"); )
+		gc_sections(roots, nroots, symfile ? symfile : stdout);
+	}
+	free(roots);
+	make_stubs(map_required ? symfile : NULL);
+
 	IFDEBUG( printf("\nRelocating sections\n"); )
-	relocate_sections();
+	if (relax) relax_sections(map_required ? symfile : NULL);
+	else relocate_sections();
+	if (pack) place_sections(symfile ? symfile : stdout);
 	IFDEBUG( dump_sections(); )
 
 	IFDEBUG( printf("\nSetting symbol values\n"); )
@@ -232,6 +354,7 @@ int main(int argc,char **argv)
 
 	if (map_required) print_map(symfile);
 	if (symbol_table_required) print_symbol_table(symfile);
+	if (symbinname || symjsonname) write_symbol_tables();
 
 	if (ofilename) {
 		char *write_mode = oformat == F_IHEX ? "w" : "wb";
@@ -252,8 +375,11 @@ int main(int argc,char **argv)
 		entry_point = entry->value;
 	}
 
-	do_out(ofile, oformat, entry_point);
+	if (ofile_window_cnt) write_windows(ofile, oformat);
+	else do_out(ofile, oformat, entry_point);
 	fclose(ofile);
+	if (window_cnt > ofile_window_cnt) write_windows(NULL, oformat);
+	write_banks(oformat);
 
 	clear_symbol();
 	die(fatalerror ? E_INPUT : E_SUCCESS, "");
@@ -273,6 +399,90 @@ int setformat(char *name, int *format)
 	return known;
 }
 
+int add_window(char *spec)
+{
+	struct window *w;
+	char *p;
+
+	if (window_cnt == MAX_WINDOWS) die(E_USAGE,
+		"ld80: Too many windows\n");
+	w = windows + window_cnt;
+
+	w->start = strtoul(spec, &p, 16);
+	if (p == spec || *p++ != ':') return 0;
+	w->end = -1;
+	if (*p && *p != ',') {
+		spec = p;
+		w->end = strtoul(spec, &p, 16);
+		if (p == spec) return 0;
+	}
+	w->filename = NULL;
+	if (*p == ',') w->filename = p+1;
+	else if (*p) return 0;
+
+	if (w->start > 0xffff || w->end > 0xffff) die(E_USAGE,
+		"ld80: Address %x is out of range\n",
+		w->start > 0xffff ? w->start : w->end);
+	if (w->end >= 0 && w->end < w->start) return 0;
+	if (!w->filename) ofile_window_cnt++;
+	window_cnt++;
+	return 1;
+}
+
+/*
+ * With ofile, writes the windows which go to the output file one after
+ * the other; otherwise writes each window which has a file of its own.
+ */
+void write_windows(FILE *ofile, int oformat)
+{
+	struct window *w;
+	FILE *f;
+
+	for (w=windows; w<windows+window_cnt; w++) {
+		if (ofile) {
+			if (!w->filename) do_window(ofile, oformat,
+				w->start, w->end);
+			continue;
+		}
+		if (!w->filename) continue;
+		if ((f=fopen(w->filename,"wb")) == NULL) die(E_USAGE,
+			"ld80: Cannot open output file %s: %s\n",
+			w->filename, strerror(errno));
+		do_window(f, oformat, w->start, w->end);
+		fclose(f);
+	}
+}
+
+void write_symbol_tables(void)
+{
+	FILE *bin = NULL, *json = NULL;
+
+	if (symbinname && (bin=fopen(symbinname,"wb")) == NULL)
+		die(E_USAGE, "ld80: Cannot open symbol file %s: %s\n",
+			symbinname, strerror(errno));
+	if (symjsonname && (json=fopen(symjsonname,"w")) == NULL)
+		die(E_USAGE, "ld80: Cannot open symbol file %s: %s\n",
+			symjsonname, strerror(errno));
+	write_symbol_table(bin, json);
+	if (bin) fclose(bin);
+	if (json) fclose(json);
+}
+
+void write_banks(int oformat)
+{
+	struct bank *b;
+	FILE *f;
+
+	for (b=banks; b<banks+bank_cnt; b++) {
+		if ((f=fopen(b->filename,
+				oformat == F_IHEX ? "w" : "wb")) == NULL)
+			die(E_USAGE, "ld80: Cannot open output file %s: %s\n",
+				b->filename, strerror(errno));
+		do_bank(f, oformat, b);
+		fclose(f);
+	}
+}
+
 void *calloc_or_die(size_t nmemb, size_t size)
 {
 	void *retval = calloc(nmemb, size);
@@ -285,10 +495,15 @@ void usage(void)
 	fprintf(stderr,
 "Usage:\n"
 "ld80 [-O oformat] [-cmV] [-W warns] -o ofile [-s symfile] [-U name] ...\n"
-"     [-S symsize] input ...\n"
+"     [--window start:[end][,file]]... [--gc-sections [--keep symbol]...]\n"
+"     [--relax] [--serial]\n"
+"     [--bank name,number,start,end,file]... [--bank-stub template]\n"
+"     [--pack start:end]... [--order module,module...]...\n"
+"     [--sym-bin file] [--sym-json file] input ...\n"
 "where oformat: ihex | hex | bin | binff | cmd\n"
 "        warns: extchain\n"
-"        input: [-l] [-P address] [-D address] [-C name,address] [-E entry]... file\n"
+"        input: [-l] [-B bank] [-P address] [-D address] [-C name,address]\n"
+"               [-E entry]... file\n"
 	);
 }
 
@@ -11,8 +11,42 @@
 #include "ld80.h"
 
 int optget_ind;
+struct longopt *optget_longopts;
 static int pos;
 
+// Long options are "--name", "--name=value" or "--name value"; they are
+// looked up in optget_longopts, and return its val.
+static int longopt(int argc, char **argv, char **arg)
+{
+	char *name = argv[optget_ind] + 2;
+	char *value = strchr(name, '=');
+	size_t len = value ? (size_t)(value - name) : strlen(name);
+	struct longopt *lo;
+
+	optget_ind++;
+	for (lo = optget_longopts; lo && lo->name; lo++) {
+		if (strlen(lo->name) != len || strncmp(lo->name, name, len))
+			continue;
+
+		if (!lo->has_arg) {
+			if (value)
+				break;
+			return lo->val;
+		}
+		if (value)
+			*arg = value + 1;
+		else if (optget_ind < argc)
+			*arg = argv[optget_ind++];
+		else
+			return '?';
+		return lo->val;
+	}
+
+	fprintf(stderr, "Unknown option '--%.*s'\n", (int)len, name);
+	optget_ind = argc;
+	return '?';
+}
+
 int optget(int argc, char **argv, char *options, char **arg)
 {
 	char *opt;
@@ -36,6 +70,8 @@ int optget(int argc, char **argv, char *options, char **arg)
 			optget_ind++;
 			return 1;
 		}
+		if (argv[optget_ind][1] == '-' && argv[optget_ind][2])
+			return longopt(argc, argv, arg);
 		// Otherwise, start looking at the argument characters.
 		pos++;
 	}
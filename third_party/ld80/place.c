@@ -0,0 +1,255 @@
+/*
+ * Placement of sections into the --pack regions. Sections which were
+ * not given an address are moved, biggest first, into the lowest gap
+ * they fit in, instead of following one another; --order lists modules
+ * whose sections have to stay in that order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "ld80.h"
+
+#define	MAX_REGIONS	16
+static struct region {
+	int start, end;		/* inclusive */
+} regions[MAX_REGIONS];
+static int region_cnt;
+
+/* the --order lists, one after the other */
+static struct order {
+	char name[NAMELEN+1];
+	int first;	/* of its list */
+} *orders;
+static int order_cnt, order_max;
+
+struct hole {
+	int start, end;		/* end is exclusive */
+};
+
+struct movable {
+	struct section *sp;
+	struct section *after;	/* has to be placed above this */
+	int placed;
+};
+
+/* --pack START:END */
+int add_region(char *spec)
+{
+	struct region *r;
+	char *p;
+
+	if (region_cnt == MAX_REGIONS) die(E_USAGE,
+		"ld80: Too many regions\n");
+	r = regions + region_cnt;
+
+	r->start = strtoul(spec, &p, 16);
+	if (p == spec || *p++ != ':') return 0;
+	spec = p;
+	r->end = strtoul(spec, &p, 16);
+	if (p == spec || *p) return 0;
+	if (r->start > 0xffff || r->end > 0xffff) die(E_USAGE,
+		"ld80: Address %x is out of range\n",
+		r->start > 0xffff ? r->start : r->end);
+	if (r->end < r->start) return 0;
+	region_cnt++;
+	return 1;
+}
+
+/* --order MODULE,MODULE... */
+int add_order(char *spec)
+{
+	struct order *o;
+	char *p, *q;
+	int len, first = 1;
+
+	for (p=spec; *p; p+=len) {
+		if (!first && *p++ != ',') return 0;
+		len = strcspn(p, ",");
+		if (len == 0 || len > NAMELEN) return 0;
+		if (order_cnt == order_max) {
+			order_max = order_max ? order_max*2 : 16;
+			orders = realloc(orders, order_max * sizeof(*orders));
+			if (orders == NULL) die(E_RESOURCE,
+				"ld80: not enough memory\n");
+		}
+		o = orders + order_cnt++;
+		memcpy(o->name, p, len);
+		o->name[len] = '\0';
+		for (q=o->name; *q; q++) *q = toupper(*q);
+		o->first = first;
+		first = 0;
+	}
+	return !first;
+}
+
+/* The section of the module listed before sp's in its segment, if any. */
+static
+struct section *ordered_after(struct section *sp)
+{
+	struct section *q;
+	int i;
+
+	for (i=0; i<order_cnt; i++)
+		if (!strcmp(orders[i].name, sp->module_name)) break;
+	if (i == order_cnt || orders[i].first) return NULL;
+	for (q=sp->segment->secs; q; q=q->next)
+		if (!strcmp(orders[i-1].name, q->module_name)) return q;
+	return NULL;
+}
+
+/* Dies on an --order name which no module has. */
+static
+void check_orders(void)
+{
+	struct segment *segp;
+	struct section *sp = NULL;
+	int i;
+
+	for (i=0; i<order_cnt; i++) {
+		for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++) {
+			for (sp=segp->secs; sp; sp=sp->next)
+				if (!strcmp(orders[i].name, sp->module_name))
+					break;
+			if (sp) break;
+		}
+		if (sp == NULL) die(E_USAGE,
+			"ld80: No module %s for --order; see the map for "
+			"module names\n", orders[i].name);
+	}
+}
+
+static
+void mark(unsigned char *used, int start, int len)
+{
+	if (start < 0) return;
+	for (; len > 0 && start <= 0xffff; len--) used[start++] = 1;
+}
+
+static
+int by_start(const void *a, const void *b)
+{
+	return ((struct hole *)a)->start - ((struct hole *)b)->start;
+}
+
+/*
+ * Moves each relocatable section which wasn't given an address, isn't
+ * in a bank and isn't main_section() into the --pack regions,
+ * and writes how full each region is to report. Returns the number of
+ * sections placed.
+ */
+int place_sections(FILE *report)
+{
+	char *segname[4] = {"absolute","code","data","common"};
+	struct segment *segp;
+	struct section *sp, *first;
+	struct movable *mv, *m, *best;
+	struct hole *holes, *h;
+	struct region *r;
+	unsigned char *used;
+	int i, cnt = 0, hole_cnt = 0, hole_max, lo, s = 0, n, total;
+
+	if (region_cnt == 0) return 0;
+	check_orders();
+	used = calloc_or_die(0x10000, 1);
+	for (i=0; i<0x10000; i++) if (MARKED(i)) used[i] = 1;	/* ASEG */
+
+	first = main_section();
+	for (segp=segv+T_CODE; segp<=segv+T_COMMON || segp->secs; segp++) {
+		if (!segp->uncommon) {
+			mark(used, segp->default_base, segp->maxsize);
+			continue;
+		}
+		for (sp=segp->secs; sp; sp=sp->next) {
+			if (sp->bank) continue;
+			if (sp->fixed || sp == first || sp->len == 0)
+				mark(used, sp->base, sp->len);
+			else cnt++;
+		}
+	}
+
+	mv = calloc_or_die(cnt ? cnt : 1, sizeof(*mv));
+	for (m=mv, segp=segv+T_CODE; segp<=segv+T_COMMON || segp->secs;
+			segp++) {
+		if (!segp->uncommon) continue;
+		for (sp=segp->secs; sp; sp=sp->next) {
+			if (sp->bank || sp->fixed || sp == first ||
+					sp->len == 0) continue;
+			m->sp = sp;
+			m->after = ordered_after(sp);
+			m++;
+		}
+	}
+
+	hole_max = 0x10000/2 + region_cnt + cnt;
+	holes = calloc_or_die(hole_max, sizeof(*holes));
+	for (r=regions; r<regions+region_cnt; r++) {
+		for (i=r->start; i<=r->end; ) {
+			if (used[i]) {
+				i++;
+				continue;
+			}
+			holes[hole_cnt].start = i;
+			while (i <= r->end && !used[i]) used[i++] = 2;
+			holes[hole_cnt++].end = i;
+		}
+	}
+	qsort(holes, hole_cnt, sizeof(*holes), by_start);
+
+	for (n=0; n<cnt; n++) {
+		best = NULL;
+		for (m=mv; m<mv+cnt; m++) {
+			if (m->placed) continue;
+			if (m->after) {	/* wait for it if it moves */
+				for (i=0; i<cnt && mv[i].sp!=m->after; i++)
+					/* EMPTY */;
+				if (i < cnt && !mv[i].placed) continue;
+			}
+			if (best == NULL || best->sp->len < m->sp->len)
+				best = m;
+		}
+		if (best == NULL) die(E_USAGE,
+			"ld80: The --order lists go round in circles\n");
+
+		sp = best->sp;
+		lo = best->after && !best->after->bank ?
+			best->after->base + best->after->len : 0;
+		for (h=holes; h<holes+hole_cnt; h++) {
+			s = h->start > lo ? h->start : lo;
+			if (s % sp->align) s += sp->align - s % sp->align;
+			if (s + sp->len <= h->end) break;
+		}
+		if (h == holes+hole_cnt) die(E_INPUT,
+			"ld80: No room for %s %s of %s in the --pack regions\n",
+			segname[sp->segment->type], sp->module_name,
+			sp->filename);
+
+		sp->base = s;
+		mark(used, s, sp->len);
+		best->placed = 1;
+		if (s > h->start && s + sp->len < h->end) {	/* split */
+			memmove(h+1, h, (holes+hole_cnt-h) * sizeof(*h));
+			hole_cnt++;
+			h[0].end = s;
+			h[1].start = s + sp->len;
+		}
+		else if (s > h->start) h->end = s;
+		else if (s + sp->len < h->end) h->start = s + sp->len;
+		else {
+			memmove(h, h+1, (holes+hole_cnt-h-1) * sizeof(*h));
+			hole_cnt--;
+		}
+	}
+
+	for (r=regions; r<regions+region_cnt; r++) {
+		for (i=r->start, total=0; i<=r->end; i++)
+			if (used[i] == 1) total++;
+		fprintf(report, "Region %.4x-%.4x %.4x of %.4x bytes used, "
+			"%.4x free\n", r->start, r->end, total,
+			r->end - r->start + 1, r->end - r->start + 1 - total);
+	}
+	free(holes);
+	free(mv);
+	free(used);
+	return cnt;
+}
@@ -1,7 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
+#ifndef WINHACK
+#include <unistd.h>
+#include <pthread.h>
+#endif
 #include "ld80.h"
 
 #define	S(special_type)	(1<<(special_type))
@@ -28,88 +33,189 @@ static int special_attrib[16] = {
 	0,						/* 15 */
 };
 
-#define byte_read() bit_read(8)
+/* item kinds, indexed by the first three bits of an item */
+#define	K_ABSOLUTE	0
+#define	K_RELATIVE	1
+#define	K_SPECIAL	2
+static const unsigned char item_kind[8] = {
+	K_ABSOLUTE, K_ABSOLUTE, K_ABSOLUTE, K_ABSOLUTE,	/* 0xx */
+	K_SPECIAL, K_RELATIVE, K_RELATIVE, K_RELATIVE,	/* 100, 1xx */
+};
+
+#define byte_read(s) bit_read(s, 8)
+#define swab(w)	((((w) & 0xff) << 8) | (((w) >> 8) & 0xff))
 void dump_item(struct object_item *);
 
-static FILE *objectfile;
+/*
+ * The whole object file is read into memory and decoded from a 64 bit
+ * buffer holding the next unread bits, most significant first. Files
+ * decoded ahead by decode_object_files() have a stream each; everything
+ * else goes through obj.
+ */
+struct objstream {
+	unsigned char *buf;
+	long len, pos;
+	uint64_t bits;
+	int count;
+	long bitpos;
+	int quiet;	/* set failed rather than die at EOF */
+	int failed;
+};
+static struct objstream obj;
 static char *objfilename;
 static int libsearch;
-static int bitpos;
+static int libindexing;	/* collect the library index in read_module() */
+
+/* the next item, read ahead by read_item_buffered() */
+static unsigned long entry_type;
+static struct object_item itembuf;
+static long itempos;	/* bit position of itembuf */
 
+/*
+ * Libraries are indexed by the byte offset of each module and the entry
+ * symbols it defines. The index comes from the file written by lib80
+ * (library name plus LIBINDEX_SUFFIX) or, failing that, is collected
+ * while scanning the library for the first time. Later passes over the
+ * library only look at the index, and seek straight to wanted modules.
+ *
+ * The index file is text, starting with a line giving the format
+ * version, the library size and its checksum, then one line per module
+ * and one per entry symbol:
+ *
+ *	LIB80 1 <size> <checksum>
+ *	M <offset> <module name>
+ *	E <entry symbol>
+ */
+#define	LIBINDEX_MAGIC		"LIB80"
+#define	LIBINDEX_VERSION	1
+
+struct libmodule {
+	long offset;
+	int first_entry;
+	int entries;
+	int loaded;
+	char name[NAMELEN+1];
+};
+
+static struct libmodule *libmodules;
+static int libmodule_cnt, libmodule_max;
+static char (*libentries)[NAMELEN+1];
+static int libentry_cnt, libentry_max;
+
+/* The items of the current object file, when it was decoded ahead. */
+struct itemlist {
+	struct object_item *item;
+	int cnt, max, pos;
+};
+static struct itemlist decoded;
+static int replaying;
+
+/* Reads filename into s, returning 0 or -1 with errno set. */
 static
-int get_bit(void)
+int read_whole_file(struct objstream *s, char *filename)
 {
-	int retval;
-	static int bytebuf;
+	FILE *objectfile;
 
-	if (bitpos%8 == 0) {
-		bytebuf = fgetc(objectfile);
-		if (bytebuf == EOF) die(E_INPUT, "ld80: Unexpected EOF "
-			"on input file %s\n", objfilename);
+	memset(s, 0, sizeof(*s));
+	objectfile=fopen(filename,"rb");
+	if (objectfile==NULL) return -1;
+
+	fseek(objectfile, 0, SEEK_END);
+	s->len = ftell(objectfile);
+	rewind(objectfile);
+	s->buf = calloc_or_die(s->len ? s->len : 1, 1);
+	if (fread(s->buf, 1, s->len, objectfile) != s->len) {
+		int e = errno;
+
+		fclose(objectfile);
+		errno = e;
+		return -1;
 	}
-	retval = (bytebuf & 0x80)!=0;
-	bytebuf <<= 1;
-	bitpos++;
-	return retval;
+	fclose(objectfile);
+	return 0;
+}
+
+static
+void load_object_file(char *filename)
+{
+	if (read_whole_file(&obj, filename) == 0) return;
+	if (obj.buf == NULL) die(E_USAGE,
+		"ld80: Cannot open object file %s: %s\n",
+		filename, strerror(errno));
+	die(E_INPUT, "ld80: Cannot read object file %s: %s\n",
+		filename, strerror(errno));
 }
 
 static
-int bit_read(int n)
+void fill_bits(struct objstream *s, int n)
 {
-	int retval = 0;
+	while (s->count <= 56 && s->pos < s->len) {
+		s->bits |= (uint64_t)s->buf[s->pos++] << (56 - s->count);
+		s->count += 8;
+	}
+	if (s->count < n) {
+		if (!s->quiet) die(E_INPUT, "ld80: Unexpected EOF "
+			"on input file %s\n", objfilename);
+		s->failed = 1;
+		s->count = 64;	/* go on reading zeros */
+	}
+}
 
-	while (n--) retval = (retval << 1) | get_bit();
-	return retval;
+static
+int bit_peek(struct objstream *s, int n)
+{
+	if (s->count < n) fill_bits(s, n);
+	return s->bits >> (64 - n);
 }
 
 static
-int word_read(void)
+int bit_read(struct objstream *s, int n)
 {
-	int low, high;
-	low = byte_read();
-	high = byte_read();
-	return (high<<8) + low;
+	int retval;
+
+	if (s->count < n) fill_bits(s, n);
+	retval = s->bits >> (64 - n);
+	s->bits <<= n;
+	s->count -= n;
+	s->bitpos += n;
+	return retval;
 }
 
 static
-unsigned long read_item(struct object_item *item)
+unsigned long read_item(struct objstream *s, struct object_item *item)
 {
 	int i;
 
-	i = bit_read(1);
-	if (i==0) {	/* absolute */
+	switch (item_kind[bit_peek(s, 3)]) {
+	case K_ABSOLUTE:	/* 0 + byte */
 		item->type = T_ABSOLUTE;
-		i = byte_read();
-		item->v.absolute_byte = i;
+		item->v.absolute_byte = bit_read(s, 9);
 		return ABS;
-	}
 
-	/* relocatable */
-	i = bit_read(2);
-	item->type = T_RELOCATABLE | i;
-	if (i != 0) {	/* relative */
-		i = word_read();
-		item->v.relative_word = i;
+	case K_RELATIVE:	/* 1 + 2 bit type + word */
+		i = bit_read(s, 19);
+		item->type = T_RELOCATABLE | ((i >> 16) & T_MASK);
+		item->v.relative_word = swab(i);
 		return RELOC;
 	}
 
-	/* special link item */
-	i = bit_read(4);
+	/* special link item: 1 00 + 4 bit control */
+	i = bit_read(s, 7) & 0xf;
+	item->type = T_RELOCATABLE | T_SPECIAL;
 	item->v.special.control = i;
 	if (special_attrib[item->v.special.control] & HAS_A) {
-		i = bit_read(2);
-		item->v.special.A_t = i;
-		i = word_read();
-		item->v.special.A_value = i;
+		i = bit_read(s, 18);	/* 2 bit type + word */
+		item->v.special.A_t = i >> 16;
+		item->v.special.A_value = swab(i);
 	}
 	if (special_attrib[item->v.special.control] & HAS_B) {
 		int len,j;
 
-		i = bit_read(3);
+		i = bit_read(s, 3);
 		len = i ? i : 8;
 		item->v.special.B_len = len;
 		for (j=0; j<len; j++) {
-			i = byte_read();
+			i = byte_read(s);
 			item->v.special.B_name[j] = i;
 		}
 		if (item->v.special.B_name[0]==' ' &&
@@ -120,18 +226,31 @@ unsigned long read_item(struct object_item *item)
 		item->v.special.B_name[0] = '\0';
 		item->v.special.B_len = 0;
 	}
-	if (special_attrib[item->v.special.control] & ALIGN && bitpos%8) {
-		bit_read(8 - bitpos%8);
+	if (special_attrib[item->v.special.control] & ALIGN && s->bitpos%8) {
+		bit_read(s, 8 - s->bitpos%8);
 	}
 	return S(item->v.special.control);
 }
 
+static
+unsigned long item_class(struct object_item *item)
+{
+	if (item->type == T_ABSOLUTE) return ABS;
+	if (item->type != (T_RELOCATABLE|T_SPECIAL)) return RELOC;
+	return S(item->v.special.control);
+}
+
 static
 int read_item_buffered(struct object_item *item, unsigned long accepted)
 {
-	static unsigned long entry_type;
-	static struct object_item itembuf;
-	if (!entry_type) entry_type = read_item(&itembuf);
+	if (!entry_type && replaying) {
+		itembuf = decoded.item[decoded.pos++];
+		entry_type = item_class(&itembuf);
+	}
+	if (!entry_type) {
+		itempos = obj.bitpos;
+		entry_type = read_item(&obj, &itembuf);
+	}
 	if (entry_type & accepted) {
 		memcpy((void*)item, (void*)&itembuf, sizeof(*item));
 		entry_type = 0;
@@ -140,17 +259,78 @@ int read_item_buffered(struct object_item *item, unsigned long accepted)
 	else return 0;
 }
 
+static
+void *grow_or_die(void *ptr, int *max, size_t size)
+{
+	*max = *max ? *max*2 : 256;
+	ptr = realloc(ptr, *max * size);
+	if (ptr==NULL) die(E_RESOURCE,"ld80: not enough memory\n");
+	return ptr;
+}
+
+static
+struct libmodule *add_libmodule(long offset, char *name)
+{
+	struct libmodule *m;
+
+	if (libmodule_cnt == libmodule_max) libmodules =
+		grow_or_die(libmodules, &libmodule_max, sizeof(*libmodules));
+	m = libmodules + libmodule_cnt++;
+	m->offset = offset;
+	m->first_entry = libentry_cnt;
+	m->entries = 0;
+	m->loaded = 0;
+	strncpy(m->name, name, NAMELEN);
+	m->name[NAMELEN] = '\0';
+	return m;
+}
+
+static
+void add_libentry(struct libmodule *m, char *name)
+{
+	if (libentry_cnt == libentry_max) libentries =
+		grow_or_die(libentries, &libentry_max, sizeof(*libentries));
+	strncpy(libentries[libentry_cnt], name, NAMELEN);
+	libentries[libentry_cnt++][NAMELEN] = '\0';
+	m->entries++;
+}
+
+static
+void clear_libindex(void)
+{
+	libmodule_cnt = 0;
+	libentry_cnt = 0;
+}
+
+static
+unsigned long checksum(unsigned char *p, long len)
+{
+	unsigned long h = 2166136261UL;	/* FNV-1a */
+
+	while (len--) h = ((h ^ *p++) * 16777619UL) & 0xffffffffUL;
+	return h;
+}
+
 int read_module(void)
 {
 	struct object_item progname_item;
 	struct object_item item;
 	struct symbol *s;
+	struct libmodule *m = NULL;
 	int load_this = !libsearch;
 
 	if (!read_item_buffered(&progname_item, PRGNAME_ELEMENT)) die(E_INPUT,
 		"ld80: Module has no name in object file %s\n", objfilename);
+	if (libindexing) {
+		if (itempos%8) die(E_INPUT, "ld80: Module %s is not byte "
+			"aligned in library %s\n",
+			progname_item.v.special.B_name, objfilename);
+		m = add_libmodule(itempos/8,
+			(char *)progname_item.v.special.B_name);
+	}
 
 	while (read_item_buffered(&item, ENTRY_ELEMENT)) {
+		if (m) add_libentry(m, (char *)item.v.special.B_name);
 		s = get_symbol((char *)item.v.special.B_name);
 		if (s && s->value==UNDEFINED) {
 			s->value = 0;
@@ -162,6 +342,7 @@ int read_module(void)
 		if (debug>1) dump_item(&progname_item);
 #endif
 		add_item(&progname_item, objfilename);
+		if (m) m->loaded = 1;
 	}
 	else if (debug) printf("Module %s:%s skipped\n",
 			objfilename, progname_item.v.special.B_name);
@@ -178,24 +359,286 @@ int read_module(void)
 	return !read_item_buffered(&item, EOF_ELEMENT);
 }
 
-int read_object_file(char *filename, int lib)
+static
+void seek_object_file(long offset)
 {
-	int modcnt = 0;
+	obj.pos = offset;
+	obj.bits = 0;
+	obj.count = 0;
+	obj.bitpos = offset*8;
+	entry_type = 0;
+}
 
-	bitpos = 0;
+/*
+ * Reads the index written by lib80, if there is one and it matches the
+ * library.
+ */
+static
+int read_libindex(char *filename)
+{
+	char *indexname;
+	FILE *f;
+	char tag[8], name[NAMELEN+1];
+	int version, n;
+	long size, offset;
+	unsigned long sum;
+	struct libmodule *m = NULL;
 
-	objectfile=fopen(filename,"rb");
-	if (objectfile==NULL) die(E_USAGE,
-		"ld80: Cannot open object file %s: %s\n",
-		filename, strerror(errno));
+	indexname = calloc_or_die(strlen(filename)+sizeof(LIBINDEX_SUFFIX), 1);
+	sprintf(indexname, "%s%s", filename, LIBINDEX_SUFFIX);
+	f = fopen(indexname, "r");
+	if (f == NULL) {
+		free(indexname);
+		return 0;
+	}
+
+	if (fscanf(f, "%7s %d %ld %lx", tag, &version, &size, &sum) != 4 ||
+			strcmp(tag, LIBINDEX_MAGIC) || version != LIBINDEX_VERSION)
+		die(E_INPUT, "ld80: Invalid library index %s\n", indexname);
+	if (size != obj.len || sum != checksum(obj.buf, obj.len)) {
+		fprintf(stderr,"ld80: Ignoring out of date library index %s\n",
+			indexname);
+		fclose(f);
+		free(indexname);
+		return 0;
+	}
+
+	while ((n = fscanf(f, "%7s", tag)) == 1) {
+		if (!strcmp(tag, "M") &&
+				fscanf(f, "%ld %8s", &offset, name) == 2 &&
+				offset >= 0 && offset < obj.len)
+			m = add_libmodule(offset, name);
+		else if (!strcmp(tag, "E") && m &&
+				fscanf(f, "%8s", name) == 1)
+			add_libentry(m, name);
+		else
+			die(E_INPUT, "ld80: Invalid library index %s\n",
+				indexname);
+	}
+
+	if (debug) printf("Using library index %s: %d modules\n",
+		indexname, libmodule_cnt);
+	fclose(f);
+	free(indexname);
+	return 1;
+}
+
+static
+int module_wanted(struct libmodule *m)
+{
+	struct symbol *s;
+	int i;
+
+	for (i=m->first_entry; i<m->first_entry+m->entries; i++) {
+		s = get_symbol(libentries[i]);
+		if (s && s->value==UNDEFINED) return 1;
+	}
+	return 0;
+}
+
+/*
+ * Loads every module of the library which satisfies an unresolved
+ * external reference, going round again until nothing new is loaded
+ * so that references back to earlier modules are resolved too.
+ */
+static
+int search_library(void)
+{
+	struct libmodule *m;
+	int loaded, modcnt = 0;
+
+	do {
+		loaded = 0;
+		for (m=libmodules; m<libmodules+libmodule_cnt; m++) {
+			if (m->loaded || !module_wanted(m)) continue;
+			seek_object_file(m->offset);
+			read_module();
+			m->loaded = 1;
+			loaded++;
+		}
+		modcnt += loaded;
+	} while (loaded);
+	return modcnt;
+}
+
+static
+void record_item(struct itemlist *l, struct object_item *item)
+{
+	if (l->cnt == l->max) l->item =
+		grow_or_die(l->item, &l->max, sizeof(*l->item));
+	l->item[l->cnt++] = *item;
+}
+
+/*
+ * Object files (not libraries) named on the command line are decoded
+ * ahead, several at once, by decode_object_files(). Only the items are
+ * made there; read_object_file() still takes them in command line order,
+ * so the link comes out just as it would have. A file which can't be
+ * decoded is left for read_object_file() to fail on in the usual way.
+ */
+struct aheadfile {
+	char *name;
+	struct objstream s;
+	struct itemlist items;
+	int ok;
+};
+static struct aheadfile *ahead;
+static int ahead_cnt, ahead_max, ahead_next, ahead_done;
+#ifndef WINHACK
+static pthread_mutex_t ahead_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+void queue_object_file(char *filename)
+{
+	if (ahead_cnt == ahead_max)
+		ahead = grow_or_die(ahead, &ahead_max, sizeof(*ahead));
+	memset(ahead + ahead_cnt, 0, sizeof(*ahead));
+	ahead[ahead_cnt++].name = filename;
+}
+
+static
+void decode_ahead(struct aheadfile *a)
+{
+	struct object_item item;
+
+	if (read_whole_file(&a->s, a->name)) return;
+	a->s.quiet = 1;
+	do {
+		read_item(&a->s, &item);
+		if (a->s.failed) return;
+		record_item(&a->items, &item);
+	} while (item_class(&item) != S(C_END_FILE));
+	a->ok = 1;
+}
+
+static
+void *ahead_worker(void *unused)
+{
+	int i;
+
+	for (;;) {
+#ifndef WINHACK
+		pthread_mutex_lock(&ahead_lock);
+#endif
+		i = ahead_next < ahead_cnt ? ahead_next++ : -1;
+#ifndef WINHACK
+		pthread_mutex_unlock(&ahead_lock);
+#endif
+		if (i < 0) return NULL;
+		decode_ahead(ahead + i);
+	}
+}
+
+/*
+ * Decodes the queued files on up to threads threads, this one included,
+ * or one for each processor if threads is 0.
+ */
+void decode_object_files(int threads)
+{
+#ifndef WINHACK
+	pthread_t *tid;
+	int i, n;
+
+	if (threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > ahead_cnt) threads = ahead_cnt;
+	tid = calloc_or_die(threads > 1 ? threads : 1, sizeof(*tid));
+	for (n=0; n<threads-1; n++)
+		if (pthread_create(tid+n, NULL, ahead_worker, NULL)) break;
+	ahead_worker(NULL);
+	for (i=0; i<n; i++) pthread_join(tid[i], NULL);
+	free(tid);
+#else
+	ahead_worker(NULL);
+#endif
+#ifdef DEBUG
+	if (debug) printf("decoded %d files ahead\n", ahead_cnt);
+#endif
+}
+
+/*
+ * Takes the items for filename if they were decoded ahead. Returns 1 if
+ * it did, with the file in obj and the items in decoded.
+ */
+static
+int take_ahead(char *filename)
+{
+	struct aheadfile *a;
+
+	if (ahead_done >= ahead_cnt || ahead[ahead_done].name != filename)
+		return 0;
+	a = ahead + ahead_done++;
+	if (!a->ok) {
+		free(a->s.buf);
+		free(a->items.item);
+		return 0;
+	}
+	free(obj.buf);
+	obj = a->s;
+	obj.quiet = 0;
+	free(decoded.item);
+	decoded = a->items;
+	decoded.pos = 0;
+	replaying = 1;
+	return 1;
+}
+
+int read_object_file(char *filename, int lib)
+{
+	int modcnt = 0;
+	struct libmodule *m;
 
 	objfilename = filename;
+	if (lib || !take_ahead(filename)) load_object_file(filename);
 	libsearch = lib;
-	while(read_module()) modcnt++;
-	fclose(objectfile);
+	entry_type = 0;
+	clear_libindex();
+	if (!lib || !read_libindex(filename)) {
+		libindexing = lib;
+		while(read_module()) modcnt++;
+		libindexing = 0;
+		if (lib) for (m=libmodules, modcnt=0;
+				m<libmodules+libmodule_cnt; m++)
+			modcnt += m->loaded;
+	}
+	if (lib) modcnt += search_library();
+	replaying = 0;
+	entry_type = 0;
+	free(obj.buf);
+	obj.buf = NULL;
 	return modcnt;
 }
 
+/*
+ * Writes an index of the library for later use by read_object_file().
+ */
+int write_library_index(char *filename, FILE *f)
+{
+	struct libmodule *m;
+	int i;
+
+	load_object_file(filename);
+	objfilename = filename;
+	libsearch = 1;
+	entry_type = 0;
+	clear_libindex();
+	libindexing = 1;
+	while(read_module()) ;
+	libindexing = 0;
+
+	fprintf(f, "%s %d %ld %.8lx\n", LIBINDEX_MAGIC, LIBINDEX_VERSION,
+		obj.len, checksum(obj.buf, obj.len));
+	for (m=libmodules; m<libmodules+libmodule_cnt; m++) {
+		fprintf(f, "M %ld %s\n", m->offset, m->name);
+		for (i=m->first_entry; i<m->first_entry+m->entries; i++)
+			fprintf(f, "E %s\n", libentries[i]);
+	}
+
+	entry_type = 0;
+	free(obj.buf);
+	obj.buf = NULL;
+	return libmodule_cnt;
+}
+
 #ifdef	DEBUG
 
 static char *stypes[] = {
@@ -0,0 +1,297 @@
+/*
+ * Linker relaxation: JP and JP cc which turn out to be close enough to
+ * their targets are shrunk to JR, and the code after them moves down.
+ *
+ * Only code assembled with zmac --relax carries what this needs: an 'R'
+ * extension item before each jump which may be shrunk, and a 'J' before
+ * each JR and DJNZ, whose displacements have to follow the code they
+ * jump over.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ld80.h"
+
+void add_relax(struct section *sp, int kind)
+{
+	struct relax *r;
+
+	if (sp->relax_cnt == sp->relax_max) {
+		sp->relax_max = sp->relax_max ? sp->relax_max*2 : 64;
+		sp->relaxes = realloc(sp->relaxes,
+			sp->relax_max * sizeof(*sp->relaxes));
+		if (sp->relaxes == NULL) die(E_RESOURCE,
+			"ld80: not enough memory\n");
+	}
+	r = sp->relaxes + sp->relax_cnt++;
+	memset(r, 0, sizeof(*r));
+	r->lc = sp->lc;
+	r->kind = kind;
+}
+
+static
+int by_lc(const void *a, const void *b)
+{
+	return ((struct relax *)a)->lc - ((struct relax *)b)->lc;
+}
+
+static
+int jr_opcode(int jp)
+{
+	switch (jp) {
+	case 0xc3: return 0x18;	/* JP */
+	case 0xc2: return 0x20;	/* JP NZ */
+	case 0xca: return 0x28;	/* JP Z */
+	case 0xd2: return 0x30;	/* JP NC */
+	case 0xda: return 0x38;	/* JP C */
+	}
+	return 0;
+}
+
+/*
+ * Works out where the jump at r goes, as a section and offset. Only the
+ * shapes zmac emits for "JP label" and "JP extern+n" are understood;
+ * anything else is left as it is.
+ */
+static
+int find_target(struct section *sp, struct relax *r)
+{
+	struct node *n;
+	int lo = 0, hi = sp->node_cnt, at = r->lc + 1, k;
+
+	if (r->lc + 3 > sp->len || !jr_opcode(sp->buffer[r->lc])) return 0;
+
+	while (lo < hi) {	/* first node at the operand */
+		k = (lo + hi) / 2;
+		if (sp->nodes[k].at.offset < at) lo = k + 1;
+		else hi = k;
+	}
+	for (k=lo; k<sp->node_cnt && sp->nodes[k].at.offset==at; k++)
+		/* EMPTY */;
+	r->node = lo;
+	r->nodes = k - lo;
+	n = sp->nodes + lo;
+
+	r->fixup = find_fixup(sp, at);
+	if (r->fixup) {
+		if (r->nodes) return 0;
+		r->target = r->fixup->at;
+		return 1;
+	}
+
+	switch (r->nodes) {
+	case 0:		/* absolute */
+		r->target.section = NULL;
+		r->target.offset = sp->buffer[at] + sp->buffer[at+1]*256;
+		return 1;
+	case 2:
+		if (n[1].type != N_WORD) return 0;
+		if (n[0].type == N_OPERAND && n[0].at.section) {
+			r->target.section = n[0].at.section;
+			r->target.offset = n[0].value;
+			return 1;
+		}
+		if (n[0].type != N_EXTERNAL) return 0;
+		r->target = n[0].symbol->at;
+		return r->target.section != NULL;
+	case 3:
+		if (n[2].type != N_WORD || n[1].type != N_EXTERNAL) return 0;
+		if (n[0].type != N_EXTPLUS && n[0].type != N_EXTMINUS) return 0;
+		if (n[0].at.section &&
+				n[0].at.section->segment->type != T_ABSOLUTE)
+			return 0;
+		r->target = n[1].symbol->at;
+		r->target.offset += n[0].type == N_EXTPLUS ?
+			n[0].value : -n[0].value;
+		return r->target.section != NULL;
+	}
+	return 0;
+}
+
+/* Bytes taken out of sp before offset, as of the last pass. */
+static
+int shrunk_before(struct section *sp, int offset)
+{
+	int lo = 0, hi = sp->relax_cnt, k;
+
+	while (lo < hi) {	/* first jump whose spare byte is at or after */
+		k = (lo + hi) / 2;
+		if (sp->relaxes[k].lc + 2 < offset) lo = k + 1;
+		else hi = k;
+	}
+	return lo < sp->relax_cnt ? sp->relaxes[lo].before : sp->relax_shrunk;
+}
+
+static
+int address(struct section *sp, int offset)
+{
+	if (sp == NULL) return offset;
+	return sp->base + offset - shrunk_before(sp, offset);
+}
+
+/* New offset in sp for what was at offset. */
+static
+int shift(struct section *sp, int offset)
+{
+	return offset - shrunk_before(sp, offset);
+}
+
+static
+void count_shrunk(struct section *sp)
+{
+	struct relax *r;
+
+	sp->relax_shrunk = 0;
+	for (r=sp->relaxes; r<sp->relaxes+sp->relax_cnt; r++) {
+		r->before = sp->relax_shrunk;
+		if (r->state == R_SHRINK) sp->relax_shrunk++;
+	}
+}
+
+/* Takes the spare byte out of each shrunk jump in sp. */
+static
+void squeeze(struct section *sp)
+{
+	struct relax *r = sp->relaxes, *end = sp->relaxes + sp->relax_cnt;
+	unsigned char *p = sp->buffer;
+	int i, t, len = sp->len + sp->relax_shrunk;
+
+	for (r=sp->relaxes; r<end; r++) {
+		if (r->kind != R_JR || r->lc + 2 > len) continue;
+		t = r->lc + 2 + (signed char)sp->buffer[r->lc+1];
+		r->disp = shift(sp, t) - shift(sp, r->lc) - 2;
+	}
+	for (i=0, r=sp->relaxes; i<len; i++) {
+		while (r < end && r->lc + 2 < i) r++;
+		if (r < end && r->lc + 2 == i && r->state == R_SHRINK) continue;
+		*p++ = sp->buffer[i];
+	}
+	for (r=sp->relaxes; r<end; r++) {
+		p = sp->buffer + shift(sp, r->lc);
+		if (r->state == R_SHRINK) *p = jr_opcode(*p);
+		else if (r->kind != R_JR || r->lc + 2 > len) continue;
+		p[1] = r->disp;
+	}
+}
+
+/*
+ * Places the sections like relocate_sections(), shrinking marked jumps
+ * until nothing more will fit. A jump which has to grow again because
+ * shrinking others moved it away from its target is never shrunk again,
+ * so this always settles. Returns the number of bytes saved.
+ */
+int relax_sections(FILE *report)
+{
+	struct segment *segp;
+	struct section *sp;
+	struct relax *r;
+	struct fixup *f;
+	struct node *n, *to;
+	int *bases, *b, *len, *l;
+	int nsecs = 0, changed, jumps = 0, saved = 0, pass, d;
+
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+		for (sp=segp->secs; sp; sp=sp->next) nsecs++;
+	bases = calloc_or_die(2*nsecs + MAX_SEGMENTS, sizeof(*bases));
+	len = bases + nsecs + MAX_SEGMENTS;
+
+	for (segp=segv, b=bases, l=len; segp<=segv+T_COMMON || segp->secs;
+			segp++) {
+		*b++ = segp->default_base;
+		for (sp=segp->secs; sp; sp=sp->next) {
+			*b++ = sp->base;
+			*l++ = sp->len;
+			qsort(sp->relaxes, sp->relax_cnt, sizeof(*sp->relaxes),
+				by_lc);
+			sort_nodes(sp);
+			for (r=sp->relaxes; r<sp->relaxes+sp->relax_cnt; r++)
+				if (r->kind == R_JP && (!segp->uncommon ||
+						!find_target(sp, r)))
+					r->state = R_PINNED;
+		}
+	}
+
+	for (pass=1; ; pass++) {
+		for (segp=segv, b=bases, l=len;
+				segp<=segv+T_COMMON || segp->secs; segp++) {
+			segp->default_base = *b++;
+			for (sp=segp->secs; sp; sp=sp->next) {
+				sp->base = *b++;
+				count_shrunk(sp);
+				sp->len = *l++ - sp->relax_shrunk;
+			}
+		}
+		pack_sections();
+		relocate_sections();
+
+		changed = 0;
+		for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+			for (sp=segp->secs; sp; sp=sp->next)
+				for (r=sp->relaxes; r<sp->relaxes+sp->relax_cnt;
+						r++) {
+			if (r->kind != R_JP || r->state == R_PINNED) continue;
+			r->disp = address(r->target.section, r->target.offset) -
+				address(sp, r->lc) - 2;
+			if (r->disp >= -128 && r->disp <= 127) {
+				if (r->state == R_KEEP) changed++;
+				r->state = R_SHRINK;
+			}
+			else if (r->state == R_SHRINK) {
+				r->state = R_PINNED;
+				changed++;
+			}
+		}
+#ifdef DEBUG
+		if (debug) printf("relax: pass %d, %d changed\n", pass, changed);
+#endif
+		if (!changed) break;
+	}
+	free(bases);
+
+	/*
+	 * Everything is where it will be; move what referred to the old
+	 * offsets. The counts from the last pass still hold.
+	 */
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+			for (sp=segp->secs; sp; sp=sp->next) {
+		for (r=sp->relaxes; r<sp->relaxes+sp->relax_cnt; r++) {
+			if (r->state != R_SHRINK) continue;
+			if (r->fixup) r->fixup->lc = -1;
+			for (d=0; d<r->nodes; d++)
+				sp->nodes[r->node+d].type = -1;
+		}
+		for (f=sp->fixups; f; f=f->next) {
+			if (f->lc >= 0) f->lc = shift(sp, f->lc);
+			if (f->at.section)
+				f->at.offset = shift(f->at.section, f->at.offset);
+		}
+	}
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+			for (sp=segp->secs; sp; sp=sp->next) {
+		for (n=to=sp->nodes; n<sp->nodes+sp->node_cnt; n++) {
+			if (n->type < 0) continue;
+			n->at.offset = shift(sp, n->at.offset);
+			if (n->type != N_EXTERNAL && n->at.section)
+				n->value = shift(n->at.section, n->value);
+			*to++ = *n;
+		}
+		sp->node_cnt = to - sp->nodes;
+	}
+	shift_symbols(shift);
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+			for (sp=segp->secs; sp; sp=sp->next) {
+		if (sp->relax_shrunk) {
+			squeeze(sp);
+			for (r=sp->relaxes; r<sp->relaxes+sp->relax_cnt; r++)
+				if (r->state == R_SHRINK) jumps++;
+			saved += sp->relax_shrunk;
+		}
+		free(sp->relaxes);
+		sp->relaxes = NULL;
+		sp->relax_cnt = sp->relax_max = sp->relax_shrunk = 0;
+	}
+
+	if (report) fprintf(report,
+		"Relaxed %d jumps in %d passes, %d bytes\n", jumps, pass, saved);
+	return saved;
+}
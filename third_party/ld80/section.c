@@ -17,6 +17,8 @@ unsigned char *aseg;
 unsigned char usage_map[0x10000/8];
 static int overlap = 0;
 static char module_name[NAMELEN+1];
+static struct bank *current_bank;	/* for code sections, set by -B */
+static struct section *entry_section;	/* of the first END with a start */
 
 static int uncommon(int, char *);
 static int base_address(int, char *);
@@ -26,7 +28,7 @@ static
 void add_section(int type, char *common_name,
 		int start, int len, char *filename)
 {
-	struct section **pp, *p = calloc_or_die(1, sizeof(*p));
+	struct section **pp, *p = arena_alloc(sizeof(*p));
 	struct segment *sp;
 
 #ifdef DEBUG
@@ -40,10 +42,19 @@ void add_section(int type, char *common_name,
 	p->filename = filename;
 	strncpy(p->module_name, module_name, NAMELEN);
 	p->base = start;
+	p->align = start < 0 ? -start : 1;
 	p->buffer = (type == T_ABSOLUTE) ? aseg : calloc_or_die(len, 1);
 
 	/* find row */
 	sp = search_segment(type, common_name, A_ENTER);
+	if (type == T_CODE && current_bank) {
+		p->bank = current_bank;	/* relocate_sections() places it */
+		p->base = -1;
+	}
+	else {
+		p->fixed = sp->base_given;
+		sp->base_given = 0;
+	}
 	/* find column */
 	for (pp=&sp->secs; *pp; pp=&((*pp)->next)) /* EMPTY */;
 	/* add new section */
@@ -139,11 +150,12 @@ void add_item(struct object_item *item, char *filename)
 		case C_PROG_SIZE:	/* 13 */
 			add_section(t, (char *)BNAME, base_address(t,(char *)BNAME),
 				AVALUE, filename);
-			if (uncommon(t,(char *)BNAME)) {
+			if (uncommon(t,(char *)BNAME) && !secs[t]->bank) {
 				base = base_address(current_section_t, (char *)BNAME);
 				if (base >= 0)
-					set_base_address(current_section_t,
-						(char *)BNAME, base + AVALUE, 0);
+					search_segment(current_section_t,
+						(char *)BNAME, A_ENTER)->
+						default_base = base + AVALUE;
 			}
 			break;
 		case C_SET_LC:		/* 11 */
@@ -175,6 +187,10 @@ void add_item(struct object_item *item, char *filename)
 				n->symbol =
 					find_symbol((char *)BNAME+1);
 				break;
+			case R_JP:	/* relaxable jump */
+			case R_JR:	/* relative jump */
+				add_relax(secs[current_section_t], b[0]);
+				break;
 			case 'C':	/* base+offset operand */
 				n = add_node(secs[current_section_t],
 					secs[current_section_t]->lc,
@@ -215,6 +231,9 @@ void add_item(struct object_item *item, char *filename)
 			die(E_INPUT, "ld80: Address chain is unimplemented."
 				" Contact the author.\n");
 		case C_END_PROGRAM:	/* 14 */
+			if (entry_section == NULL && ATYPE != T_ABSOLUTE)
+				entry_section = secs[ATYPE];
+			break;
 		case C_END_FILE:	/* 15 */
 			break;
 		/********************** head *************************/
@@ -263,6 +282,24 @@ struct segment *search_segment(int type, char *common_name, int action)
 	return s;
 }
 
+/* Puts the code sections which follow in b, or in the image if NULL. */
+void set_bank(struct bank *b)
+{
+	current_bank = b;
+}
+
+/*
+ * Adds a code section made by the linker itself after all the others,
+ * where the next object file's code would have gone.
+ */
+struct section *add_code_section(char *name, int len)
+{
+	current_bank = NULL;
+	strncpy(module_name, name, NAMELEN);
+	add_section(T_CODE, NULL, base_address(T_CODE, NULL), len, "(ld80)");
+	return secs[T_CODE];
+}
+
 void mark_uncommon(char *common_name)
 {
 	search_segment(T_COMMON, common_name, A_ENTER)->uncommon = 1;
@@ -279,11 +316,15 @@ int uncommon(int type, char *common_name)
 
 void set_base_address(int type, char *common_name, int base, int align)
 {
+	struct segment *sp;
+
 	if (align) {
 		base = -base;	/* alignment is represented by negative value */
 		if (base == 0) base = -1;
 	}
-	search_segment(type, common_name, A_ENTER)->default_base = base;
+	sp = search_segment(type, common_name, A_ENTER);
+	sp->default_base = base;
+	sp->base_given = 1;
 }
 
 static
@@ -353,7 +394,7 @@ void dump_sections(void)
 				"len=%.4x module=%s:%s\n", sp,
 				sp->base, sp->lc, sp->len,
 				sp->filename, sp->module_name);
-			for (n=sp->nodehead; n; n=n->next) {
+			for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++) {
 				printf("    node: offset=%.4x type=%d "
 					"value=%.4x name=%s\n",
 					n->at.offset, n->type,
@@ -369,15 +410,159 @@ void dump_sections(void)
 }
 #endif	/* ifdef DEBUG */
 
+/*
+ * The section the program starts in: the one holding the first start
+ * address given with END, otherwise the first code section outside the
+ * banks which isn't empty. NULL if there's no code.
+ */
+struct section *main_section(void)
+{
+	struct section *sp;
+
+	if (entry_section && !entry_section->removed) return entry_section;
+	for (sp=segv[T_CODE].secs; sp && (sp->bank || sp->len == 0);
+			sp=sp->next)
+		/* EMPTY */;
+	return sp;
+}
+
+static struct section **gc_stack;
+static int gc_depth;
+
+static
+void gc_mark(struct section *sp)
+{
+	if (sp == NULL || sp->reachable) return;
+	sp->reachable = 1;
+	gc_stack[gc_depth++] = sp;
+}
+
+/*
+ * Drops the code, data and uncommon common sections which can't be
+ * reached through fixups, expressions and external references from
+ * main_section(), the sections defining the named root symbols,
+ * sections placed with -P, -D or -C, absolute sections and overlapping
+ * commons; a section the user put somewhere is meant to be there, as
+ * with a BIOS which nothing in the link calls. The rest close up over
+ * the gaps. Each dropped section is listed on report. Returns the
+ * number of bytes saved.
+ */
+int gc_sections(char **roots, int nroots, FILE *report)
+{
+	char *segname[4] = {"absolute","code","data","common"};
+	struct segment *segp;
+	struct section *sp, *np, **pp;
+	struct fixup *f;
+	struct node *n;
+	struct symbol *s;
+	int i, secno = 0, dropped = 0, saved = 0;
+
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+		for (sp=segp->secs; sp; sp=sp->next) secno++;
+	gc_stack = calloc_or_die(secno ? secno : 1, sizeof(*gc_stack));
+	gc_depth = 0;
+
+	for (segp=segv; segp<=segv+T_COMMON || segp->secs; segp++)
+		for (sp=segp->secs; sp; sp=sp->next)
+			if (sp->fixed || segp->type == T_ABSOLUTE ||
+					(segp->type == T_COMMON &&
+					!segp->uncommon))
+				gc_mark(sp);
+	for (i=0; i<nroots; i++) {
+		s = get_symbol(roots[i]);
+		if (s == NULL || s->at.section == NULL) die(E_USAGE,
+			"ld80: Root symbol '%s' not found.\n", roots[i]);
+		gc_mark(s->at.section);
+	}
+	sp = main_section();
+	for (np=segv[T_CODE].secs; np && np->bank; np=np->next)
+		/* EMPTY */;
+	if (np && np != sp && entry_section == NULL) fprintf(stderr,
+		"ld80: Warning: The first code section, of module %s, is "
+		"empty; keeping what %s reaches\n", np->module_name,
+		sp ? sp->module_name : "nothing");
+	gc_mark(sp);
+
+	while (gc_depth) {
+		sp = gc_stack[--gc_depth];
+		for (f=sp->fixups; f; f=f->next)
+			if (f->lc >= 0) gc_mark(f->at.section);
+		for (n=sp->nodes; n<sp->nodes+sp->node_cnt; n++) {
+			gc_mark(n->at.section);
+			if (n->symbol) gc_mark(n->symbol->at.section);
+		}
+	}
+	free(gc_stack);
+	gc_stack = NULL;
+
+	for (segp=segv+T_CODE; segp<=segv+T_COMMON || segp->secs; segp++) {
+		if (!segp->uncommon) continue;
+		for (pp=&segp->secs; (sp=*pp) != NULL; ) {
+			if (sp->reachable) {
+				pp = &sp->next;
+				continue;
+			}
+
+			if (sp->len) {
+				fprintf(report,
+					"Removed %-6s %-8s %-16s %.4x bytes\n",
+					segname[segp->type], sp->module_name,
+					sp->filename, sp->len);
+				dropped++;
+				saved += sp->len;
+			}
+			*pp = sp->next;
+			sp->removed = 1;
+			free(sp->buffer);
+			sp->buffer = NULL;
+		}
+	}
+	pack_sections();
+	fprintf(report, "Removed %d unreferenced sections, %d bytes\n",
+		dropped, saved);
+	return saved;
+}
+
+/*
+ * Moves each concatenated section which wasn't given an address with
+ * -P, -D or -C up against the one before it, after sections have been
+ * dropped or have shrunk.
+ */
+void pack_sections(void)
+{
+	struct segment *segp;
+	struct section *sp;
+	int loc;
+
+	for (segp=segv+T_CODE; segp<=segv+T_COMMON || segp->secs; segp++) {
+		if (!segp->uncommon) continue;
+		loc = -1;
+		for (sp=segp->secs; sp; sp=sp->next) {
+			if (sp->bank) continue;
+			if (!sp->fixed && loc >= 0) sp->base = loc;
+			loc = sp->base >= 0 ? sp->base + sp->len : -1;
+		}
+	}
+}
+
 void relocate_sections(void)
 {
 	struct section *sp;
 	struct segment *segp;
+	struct bank *b;
 	int loc = 0;	/* default CSEG location */
 	int m;
 
+	for (b=banks; b<banks+bank_cnt; b++) b->loc = b->start;
 	for (segp=segv+T_CODE; segp<segv+T_COMMON || segp->secs; segp++) {
 		if (segp->uncommon) for (sp=segp->secs; sp; sp=sp->next) {
+			if ((b = sp->bank) != NULL) {
+				sp->base = b->loc;
+				b->loc += sp->len;
+				if (b->loc > b->end + 1) die(E_INPUT,
+					"ld80: Bank %s is too small\n", b->name);
+				continue;
+			}
 			if (sp->base < 0 ) {
 				m = -sp->base;
 				if (loc % m) loc += m - loc % m;
@@ -413,6 +598,13 @@ void join_sections(int nodata)
 			(segp<segv+T_COMMON || segp->secs);
 			segp++) {
 		for (sp=segp->secs; sp; sp=sp->next) {
+			if (sp->bank) {
+				memcpy(sp->bank->image + sp->base - sp->bank->start,
+					sp->buffer, sp->len);
+				free(sp->buffer);
+				sp->buffer = NULL;
+				continue;
+			}
 			overlap = 0;
 			for (i=sp->base, p=sp->buffer, len=sp->len;
 					len; i++, p++, len--) {
@@ -451,7 +643,7 @@ int by_base(const void *a, const void *b)
 
 void print_map(FILE *f)
 {
-	char segtype[] = "APDC", buf[NAMELEN+5];
+	char segtype[] = "APDC", buf[NAMELEN+6];
 	struct segment *segp;
 	struct section **slist, *sp;
 	int secno = 0, i = 0;
@@ -476,6 +668,7 @@ void print_map(FILE *f)
 		if (sp->len == 0) continue;
 		if (sp->segment->type == T_COMMON)
 			sprintf(buf,"C  /%s/", sp->segment->common_name);
+		else if (sp->bank) sprintf(buf,"P  [%s]", sp->bank->name);
 		else sprintf(buf,"%c  -",segtype[sp->segment->type]);
 		fprintf(f,"%.4x   %.4x   %-13s %-8s %s\n",
 			sp->base, sp->len, buf, sp->module_name, sp->filename);
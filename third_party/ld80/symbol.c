@@ -1,34 +1,95 @@
-#ifndef NEED_HSEARCH
-#include <search.h>
-#endif
-
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include "ld80.h"
 
-static struct symbol *symbol_table;
-static int next_symbol, symbol_table_size;
+/*
+ * Symbols are allocated in blocks, so that they never move and can be
+ * walked in the order they were created. They are found through an open
+ * addressing hash table keyed by the name, zero padded to NAMELEN bytes
+ * and packed into 64 bits, which doubles whenever it gets half full.
+ */
+#define	SYMBOL_BLOCK	1024
+#define	SYMBOL(i)	(symbol_blocks[(i)/SYMBOL_BLOCK] + (i)%SYMBOL_BLOCK)
+
+struct symhash {
+	uint64_t key;
+	struct symbol *symbol;
+};
+
+static struct symbol **symbol_blocks;
+static int next_symbol;
+static struct symhash *symhash;
+static int symhash_size;	/* power of two */
+
+static
+int name_key(char *name, uint64_t *key)
+{
+	char buf[NAMELEN] = { 0 };
+	size_t len = strlen(name);
+
+	if (len > NAMELEN) return 0;
+	memcpy(buf, name, len);
+	memcpy(key, buf, NAMELEN);
+	return 1;
+}
+
+static
+struct symhash *lookup(uint64_t key)
+{
+	unsigned mask = symhash_size-1;
+	unsigned i = ((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+
+	while (symhash[i].symbol && symhash[i].key != key) i = (i+1) & mask;
+	return symhash + i;
+}
+
+static
+void grow_symhash(void)
+{
+	struct symhash *old = symhash, *h;
+	int i, oldsize = symhash_size;
+
+	symhash_size = symhash_size ? symhash_size*2 : 4096;
+	symhash = calloc_or_die(symhash_size, sizeof(*symhash));
+	for (i=0; i<oldsize; i++) {
+		if (old[i].symbol == NULL) continue;
+		h = lookup(old[i].key);
+		*h = old[i];
+	}
+	free(old);
+}
 
 struct symbol *find_symbol(char *name)
 {
 	struct symbol *sym;
-	ENTRY e, *ep;
+	struct symhash *h;
+	uint64_t key;
+
+	if (!name_key(name, &key)) die(E_INPUT,
+		"ld80: Symbol name %s is too long\n", name);
+	h = lookup(key);
+	if (h->symbol) return h->symbol;
 
-	sym = get_symbol(name);
-	if (sym) return sym;
+	if (next_symbol%SYMBOL_BLOCK == 0) {
+		int blocks = next_symbol/SYMBOL_BLOCK + 1;
 
-	if (next_symbol >= symbol_table_size) die(E_RESOURCE,
-		"ld80: Symbol table exceeds %d entries. "
-		"Use -S option.\n", symbol_table_size);
-	sym = symbol_table + next_symbol++;
+		symbol_blocks = realloc(symbol_blocks,
+			blocks * sizeof(*symbol_blocks));
+		if (symbol_blocks == NULL) die(E_RESOURCE,
+			"ld80: not enough memory\n");
+		symbol_blocks[blocks-1] = calloc_or_die(SYMBOL_BLOCK,
+			sizeof(struct symbol));
+	}
+	sym = SYMBOL(next_symbol);
+	next_symbol++;
 	strcpy(sym->name, name);
 	sym->value = UNDEFINED;
 
-	e.key = strdup(sym->name);
-	e.data = (char *)sym;
-	ep = hsearch(e, ENTER);
-	if (ep == NULL) die(E_RESOURCE, "ld80: Not enough memory\n");
+	h->key = key;
+	h->symbol = sym;
+	if (next_symbol*2 > symhash_size) grow_symhash();
 	return sym;
 }
 
@@ -50,11 +111,10 @@ int add_symbol(char *name, int offset, struct section *section)
 
 struct symbol *get_symbol(char *name)
 {
-	ENTRY e, *ep;
+	uint64_t key;
 
-	e.key = name;
-	ep = hsearch(e, FIND);
-	return (struct symbol *)(ep ? ep->data : NULL);
+	if (!name_key(name, &key)) return NULL;
+	return lookup(key)->symbol;
 }
 
 void set_symbols(void)
@@ -62,27 +122,44 @@ void set_symbols(void)
 	int i;
 	struct symbol *s;
 
-	for (i=0; i<symbol_table_size; i++) {
-		s = symbol_table + i;
+	for (i=0; i<next_symbol; i++) {
+		s = SYMBOL(i);
 		if (s->at.section == NULL) break;
 		s->value = s->at.section->base + s->at.offset;
 	}
 }
 
-int init_symbol(int n)
+/* Moves symbols when code is taken out of their section. */
+void shift_symbols(int (*offset)(struct section *, int))
+{
+	int i;
+	struct symbol *s;
+
+	for (i=0; i<next_symbol; i++) {
+		s = SYMBOL(i);
+		if (s->at.section)
+			s->at.offset = offset(s->at.section, s->at.offset);
+	}
+}
+
+void init_symbol(void)
 {
-	symbol_table = calloc(n, sizeof(struct symbol));
-	if (symbol_table == NULL || hcreate(n) == 0)
-		die(E_RESOURCE, "ld80: Not enough memory for %d symbols\n", n);
 	next_symbol = 0;
-	symbol_table_size = n;
-	return n;
+	grow_symhash();
 }
 
 void clear_symbol(void)
 {
-	free(symbol_table);
-	hdestroy();
+	int i;
+
+	for (i=0; i<next_symbol; i+=SYMBOL_BLOCK)
+		free(symbol_blocks[i/SYMBOL_BLOCK]);
+	free(symbol_blocks);
+	free(symhash);
+	symbol_blocks = NULL;
+	symhash = NULL;
+	symhash_size = 0;
+	next_symbol = 0;
 }
 
 #ifdef	DEBUG
@@ -90,24 +167,18 @@ void dump_symbols(void)
 {
 	int i;
 
+	struct symbol *s;
+
 	for (i=0; i<next_symbol; i++) {
+		s = SYMBOL(i);
 		printf("name=%-8s section=%p offset=%.4x value=%.4x\n",
-			symbol_table[i].name, symbol_table[i].at.section,
-			symbol_table[i].at.offset, symbol_table[i].value);
+			s->name, s->at.section, s->at.offset, s->value);
 	}
 }
 #endif
 
 #define	SYM(x)	(*((struct symbol **)(x)))
 
-/*
-static
-int by_value(const void *a, const void *b)
-{
-	return SYM(a)->value - SYM(b)->value;
-}
-*/
-
 static
 int by_name(const void *a, const void *b)
 {
@@ -120,7 +191,7 @@ void print_symbol_table(FILE *f)
 	struct symbol *s, **slist, **sp;
 
 	slist = calloc_or_die(next_symbol, sizeof(*slist));
-	for (i=0; i<next_symbol; i++) slist[i] = symbol_table+i;
+	for (i=0; i<next_symbol; i++) slist[i] = SYMBOL(i);
 	qsort((void*)slist, next_symbol, sizeof(*slist), by_name);
 
 	fprintf(f,
@@ -129,9 +200,206 @@ void print_symbol_table(FILE *f)
 
 	for (i=0,sp=slist; i<next_symbol; i++, sp++) {
 		s = *sp;
+		if (s->at.section && s->at.section->removed) continue;
 		if (s->at.section) fprintf(f,"%-8s %.4x  %-8s %s\n",
 				s->name, s->value, s->at.section->module_name,
 				s->at.section->filename);
 		else fprintf(f,"%-8s *** UNDEFINED ***\n", s->name);
 	}
 }
+
+static
+int by_value(const void *a, const void *b)
+{
+	int i = SYM(a)->value - SYM(b)->value;
+
+	return i ? i : strcmp(SYM(a)->name, SYM(b)->name);
+}
+
+/* The main image first, then each bank by number, each by address. */
+static
+int by_bank_value(const void *a, const void *b)
+{
+	struct bank *ba = SYM(a)->at.section->bank;
+	struct bank *bb = SYM(b)->at.section->bank;
+
+	if (ba != bb) {
+		if (ba == NULL || bb == NULL) return ba ? 1 : -1;
+		if (ba->id != bb->id) return ba->id - bb->id;
+		return ba - bb;
+	}
+	return by_value(a, b);
+}
+
+static
+void put16(unsigned char *p, unsigned v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static
+void put32(unsigned char *p, unsigned long v)
+{
+	put16(p, v & 0xffff);
+	put16(p+2, v >> 16);
+}
+
+/* What kind of section s is in, as print_map() shows it. */
+static
+char *section_name(struct section *sp, char *buf)
+{
+	char *segname[4] = {"abs","code","data","common"};
+
+	if (sp->segment->type == T_COMMON)
+		sprintf(buf, "/%s/", sp->segment->common_name);
+	else strcpy(buf, segname[sp->segment->type]);
+	return buf;
+}
+
+static
+void json_string(FILE *f, char *s)
+{
+	putc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < ' ') fprintf(f, "\\u%.4x", *s);
+		else putc(*s, f);
+	}
+	putc('"', f);
+}
+
+/*
+ * Writes the defined symbols for tools which look up addresses. Banks
+ * can share addresses with each other and with the main image, so the
+ * symbols are in order of bank, those outside any bank first and then
+ * each bank by number, and within that by address; a lookup has to know
+ * which bank is mapped in. The size of a symbol is the distance to the
+ * next higher one in the same bank, or to the end of its section for the
+ * last. bin gets a header
+ *
+ *	"LD80SYM" 1		magic and version
+ *	u16 record size, u16 0, u32 record count, u32 string table offset
+ *
+ * then fixed size records, little endian,
+ *
+ *	u16 address, u16 size, u8 segment type (A, P, D or C),
+ *	u8 1 if banked, u8 bank number, u8 0, char name[8],
+ *	char module[8], u32 file, u32 section
+ *
+ * where file and section are offsets into the string table which
+ * follows, and names are zero padded. json gets the same as an array of
+ * objects. Either may be NULL.
+ */
+#define	SYMHDR_SIZE	20
+#define	SYMREC_SIZE	32
+#define	SYMBIN_MAGIC	"LD80SYM\1"
+
+void write_symbol_table(FILE *bin, FILE *json)
+{
+	struct symbol *s, **slist;
+	struct section *sp;
+	unsigned char rec[SYMREC_SIZE];
+	char buf[NAMELEN+3], **strv = NULL;
+	int i, j, n = 0, size, end, nstr = 0, strmax = 0;
+	long stroff = 1, *offv = NULL;
+	char segtype[] = "APDC";
+
+	slist = calloc_or_die(next_symbol ? next_symbol : 1, sizeof(*slist));
+	for (i=0; i<next_symbol; i++) {
+		s = SYMBOL(i);
+		if (s->at.section == NULL || s->at.section->removed) continue;
+		slist[n++] = s;
+	}
+	qsort((void*)slist, n, sizeof(*slist), by_bank_value);
+
+	/* The string table: "" and then each file and section name once. */
+	if (bin) for (i=0; i<2*n; i++) {
+		char *str = i%2 ? section_name(slist[i/2]->at.section, buf) :
+			slist[i/2]->at.section->filename;
+
+		for (j=0; j<nstr && strcmp(strv[j], str); j++) /* EMPTY */;
+		if (j < nstr) continue;
+		if (nstr == strmax) {
+			strmax = strmax ? strmax*2 : 64;
+			strv = realloc(strv, strmax * sizeof(*strv));
+			offv = realloc(offv, strmax * sizeof(*offv));
+			if (strv == NULL || offv == NULL) die(E_RESOURCE,
+				"ld80: not enough memory\n");
+		}
+		strv[nstr] = strdup(str);
+		if (strv[nstr] == NULL) die(E_RESOURCE,
+			"ld80: not enough memory\n");
+		offv[nstr++] = stroff;
+		stroff += strlen(str) + 1;
+	}
+
+	if (bin) {
+		memset(rec, 0, sizeof(rec));
+		memcpy(rec, SYMBIN_MAGIC, 8);
+		put16(rec+8, SYMREC_SIZE);
+		put32(rec+12, n);
+		put32(rec+16, SYMHDR_SIZE + (unsigned long)n*SYMREC_SIZE);
+		fwrite(rec, 1, SYMHDR_SIZE, bin);
+	}
+	if (json) fprintf(json, "[");
+
+	for (i=0; i<n; i++) {
+		s = slist[i];
+		sp = s->at.section;
+		for (j=i+1; j<n && slist[j]->value==s->value &&
+				slist[j]->at.section->bank==sp->bank; j++)
+			/* EMPTY */;
+		if (j < n && slist[j]->at.section->bank == sp->bank) size = slist[j]->value - s->value;
+		else {
+			end = sp->base + sp->len;
+			size = end > s->value ? end - s->value : 0;
+		}
+
+		if (bin) {
+			memset(rec, 0, sizeof(rec));
+			put16(rec, s->value);
+			put16(rec+2, size);
+			rec[4] = segtype[sp->segment->type];
+			rec[5] = sp->bank != NULL;
+			rec[6] = sp->bank ? sp->bank->id : 0;
+			memcpy(rec+8, s->name, strlen(s->name));
+			memcpy(rec+16, sp->module_name, strlen(sp->module_name));
+			for (j=0; strcmp(strv[j], sp->filename); j++)
+				/* EMPTY */;
+			put32(rec+24, offv[j]);
+			section_name(sp, buf);
+			for (j=0; strcmp(strv[j], buf); j++) /* EMPTY */;
+			put32(rec+28, offv[j]);
+			fwrite(rec, 1, SYMREC_SIZE, bin);
+		}
+		if (json) {
+			fprintf(json, "%s\n  {\"name\": ", i ? "," : "");
+			json_string(json, s->name);
+			fprintf(json, ", \"address\": %d, \"size\": %d, "
+				"\"module\": ", s->value, size);
+			json_string(json, sp->module_name);
+			fprintf(json, ", \"file\": ");
+			json_string(json, sp->filename);
+			fprintf(json, ", \"section\": ");
+			json_string(json, section_name(sp, buf));
+			if (sp->bank) {
+				fprintf(json, ", \"bank\": ");
+				json_string(json, sp->bank->name);
+			}
+			fprintf(json, "}");
+		}
+	}
+
+	if (bin) {
+		putc('\0', bin);
+		for (j=0; j<nstr; j++) {
+			fwrite(strv[j], 1, strlen(strv[j]) + 1, bin);
+			free(strv[j]);
+		}
+	}
+	if (json) fprintf(json, "\n]\n");
+	free(strv);
+	free(offv);
+	free(slist);
+}
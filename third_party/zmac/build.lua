@@ -22,6 +22,7 @@ definerule("zmac",
     {
         srcs = { type="targets" },
         deps = { type="targets", default={} },
+        incdirs = { type="strings", default={} },
         relocatable = { type="boolean", default=true },
     },
     function (e)
@@ -32,8 +33,17 @@ definerule("zmac",
         local relflag = e.relocatable and "--rel7" or ""
         local ext = e.relocatable and ".rel" or ".cim"
 
+        -- Included files are picked up from the depfile zmac writes, so
+        -- include directories needn't be dependencies.
+        local dirs = {}
+        for _, t in ipairs(e.incdirs) do
+            if t:find("^%./") then
+                t = concatpath(e.cwd, t)
+            end
+            dirs[#dirs+1] = t
+        end
         local hdrpaths = {}
-        for _, t in pairs(uniquify(dirname(filenamesof(e.deps)))) do
+        for _, t in pairs(uniquify(concat(dirs, dirname(filenamesof(e.deps))))) do
             hdrpaths[#hdrpaths+1] = "-I"..t
         end
 
@@ -44,9 +54,10 @@ definerule("zmac",
                 e.srcs
             },
             outleaves = { e.name..ext, e.name..".lst" },
+            depleaf = e.name..".d",
             deps = e.deps,
             commands = {
-                "%{ins[1]} --zmac -m "..relflag.." "..archflag.." -o %{outs[1]} -o %{outs[2]} %{hdrpaths} %{ins[2]}"
+                "%{ins[1]} --zmac -m "..relflag.." "..archflag.." --depfile %{depfile} -o %{outs[1]} -o %{outs[2]} %{hdrpaths} %{ins[2]}"
             },
             vars = {
                 hdrpaths = hdrpaths,
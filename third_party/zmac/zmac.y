@@ -216,6 +216,11 @@
 
 #if defined(__APPLE__) || defined(__linux__)
 #include <unistd.h>	// just for unlink
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#define HAVE_MMAP	// for reading source files
+#define HAVE_FORK	// for --batch
 #endif
 
 #include "zi80dis.h"
@@ -240,7 +245,6 @@
 #define YYDEBUG 1
 #endif
 
-#define ITEMTABLESIZE	100000
 #define TEMPBUFSIZE	(1000+MAXSYMBOLSIZE)
 #define LINEBUFFERSIZE	1000
 #define EMITBUFFERSIZE	200
@@ -297,10 +301,13 @@ struct	item	{
 	int	i_scope;
 	int	i_chain;
 	int	i_pass;
+	unsigned int	i_hash;
 };
 
 void itemcpy(struct item *dst, struct item *src);
 struct item *keyword(char *name);
+unsigned int item_hash(char *name);
+int keymacros;		/* a macro has the name of a keyword */
 
 #define SCOPE_NONE	(0)
 #define SCOPE_PROGRAM	(1)
@@ -342,9 +349,7 @@ FILE	*fout,
 	*f1500wav,
 	*f1000wav,
 	*f500wav,
-	*f250wav,
-	*fin[NEST_IN],
-	*now_file ;
+	*f250wav;
 
 char *output_dir = "zout";
 
@@ -383,6 +388,8 @@ int getoptarg(int argc, char *argv[], int i);
 void stop_all_outf();
 void clean_outf();
 void clean_outf_temp();
+void note_file(char *path);
+void write_depfile();
 void suffix_list(char *sfx_lst, int no_open);
 
 int	pass2;	/*set when pass one completed*/
@@ -403,6 +410,12 @@ char	modstr[8];	// Replacement string for '?' in labels when MRAS compatible
 int	relopt;		// Only output .rel files and length of external symbols
 char	progname[8];	// Program name for .rel output
 int	note_depend;	// Print names of files included
+char	*depfile;	// Write a make rule for the outputs to this file
+char	**depnames;	// of the files read, for depfile
+int	depcnt, depmax;
+int	relaxopt;	// Mark jumps in .rel output which the linker may shrink
+int	default_relaxopt;
+int	relax_used;	// Any jumps marked, so every JR needs marking too
 int	firstcol;
 int	logcol;
 int	coloncnt;
@@ -423,6 +436,24 @@ int	linein[NEST_IN] ;
 int linepeek[NEST_IN];
 int	now_in ;
 
+/*
+ *  Source and include files are read whole, the first time they are
+ *  needed, and kept by path so that later passes and later includes of
+ *  the same file take them from memory.  Only the characters are kept;
+ *  every pass still lexes them as conditionals and macros can turn out
+ *  differently each time.
+ */
+struct srcfile {
+	char	*sf_name;	// path it was opened by
+	char	*sf_text;	// 0 if it could not be opened
+	int	sf_len;
+	struct srcfile *sf_next;
+};
+
+struct srcfile *srcfiles;
+struct srcfile *fsrc[NEST_IN];	// source at each nesting level
+int	fpos[NEST_IN];		// and where it is up to
+
 
 // These first 5 errors are singled out in lsterr1() for reasons I don't
 // quite understand.
@@ -638,6 +669,7 @@ void expr_free(struct expr *ex);
 int can_extend_link(struct expr *ex);
 void extend_link(struct expr *ex);
 void putrelop(int op);
+void relaxmark(int kind);
 void dolopt(int enable, int op);
 #define RELOP_BYTE	(1)
 #define RELOP_WORD	(2)
@@ -651,8 +683,11 @@ void dolopt(int enable, int op);
 #define RELOP_DIV	(10)
 #define RELOP_MOD	(11)
 struct item *item_lookup(char *name, struct item *table, int table_size);
-struct item *item_substr_lookup(char *name, int token, struct item *table, int table_size);
+struct item *item_substr_lookup(char *name);
+void param_index_add(struct item *param);
+void param_index_clear();
 struct item *locate(char *name);
+void item_commit();
 // Data descriptions for emit()
 #define E_CODE		(0)
 #define E_DATA		(1)
@@ -683,11 +718,16 @@ void listfrombookmark();
 #define NOPEEK (EOF - 1)
 int	peekc;
 int	nextline_peek;
+struct srcfile *src_load(char *path);
+void src_open(struct srcfile *sf);
+int src_getc();
+unsigned char *src_getline(unsigned char *p);
 
 /* function prototypes */
 void error(char *as);
 void usage(char *msg, char *param);
 void help();
+int assemble(int argc, char *argv[]);
 void list_out(int optarg, char *line_str, char type);
 void erreport();
 void errorprt(int errnum);
@@ -704,7 +744,6 @@ void insymtab(char *name);
 void outsymtab(char *name);
 void compactsymtab();
 void putsymtab();
-void clear();
 void setmem(int addr, int value, int type);
 void setvars();
 void flushbin();
@@ -1106,18 +1145,23 @@ void emitjr(int opcode, struct expr *dest)
 				emit(2, E_CODE16, dest, 0x05, 0xC2); // DEC B, JP NZ
 				break;
 			case 0x18: // JR
+				relaxmark('R');
 				emit(1, E_CODE16, dest, 0xC3); // JP
 				break;
 			case 0x20: // JR NZ
+				relaxmark('R');
 				emit(1, E_CODE16, dest, 0xC2); // JP NZ
 				break;
 			case 0x28: // JR Z
+				relaxmark('R');
 				emit(1, E_CODE16, dest, 0xCA); // JP Z
 				break;
 			case 0x30: // JR NC
+				relaxmark('R');
 				emit(1, E_CODE16, dest, 0xD2); // JP NC
 				break;
 			case 0x38: // JR C
+				relaxmark('R');
 				emit(1, E_CODE16, dest, 0xDA); // JP C
 				break;
 			default:
@@ -1133,11 +1177,31 @@ void emitjr(int opcode, struct expr *dest)
 		}
 	}
 	else {
+		relaxmark('J');
 		emit(2, E_CODE, 0, opcode, disp);
 		expr_free(dest);
 	}
 }
 
+// Tell the linker that the jump (or JR) about to be emitted may be
+// relaxed (or needs its displacement fixing if code around it shrinks).
+void relaxmark(int kind)
+{
+	if (!relopt || !z80 || segment == SEG_ABS)
+		return;
+	if (kind == 'R' ? !relaxopt : !relax_used)
+		return;
+
+	if (segchange) {
+		segchange = 0;
+		putrelcmd(RELCMD_SETLOC);
+		putrelsegref(segment, seg_pos[segment]);
+	}
+	putrelcmd(RELCMD_EXTLINK);
+	putrelbits(3, 1);
+	putrelbits(8, kind);
+}
+
 void checkjp(int op, struct expr *dest)
 {
 	op &= 0x030;
@@ -1850,6 +1914,7 @@ void do_defl(struct item *sym, struct expr *val, int call_list);
 %token <ival> TWOCHAR
 %token JRPROMOTE
 %token JPERROR
+%token RELAX
 %token PUBLIC
 %token EXTRN
 %token MRAS_MOD
@@ -2409,6 +2474,15 @@ statement:
 		list1();
 		expr_free($2);
 	}
+|
+	RELAX expression '\n' {
+		expr_number_check($2);
+		relaxopt = !!$2->e_value;
+		if (relaxopt)
+			relax_used = 1;
+		list1();
+		expr_free($2);
+	}
 |
 	PUBLIC public.list '\n' {
 		list1();
@@ -2449,6 +2523,7 @@ statement:
 		$1->i_pass = npass;
 		$1->i_value = mfptr;
 		if (keyword($1->i_string)) {
+			keymacros = 1;
 			sprintf(detail, "Macro '%s' will override the built-in '%s'",
 				$1->i_string, $1->i_string);
 			errwarn(warn_general, detail);
@@ -2799,6 +2874,7 @@ operation:
 	{
 		if (z80 || $1->i_value == 0303) {
 			checkjp(0, $2);
+			relaxmark('R');
 			emit(1, E_CODE16, $2, 0303);
 		}
 		else
@@ -3037,12 +3113,16 @@ operation:
 	JP condition ',' expression
 	{
 		checkjp($2, $4);
+		if ($2 < 040)
+			relaxmark('R');
 		emit(1, E_CODE16, $4, 0302 + $2);
 	}
 |
 	JUMP8 expression
 	{
 		checkjp($1->i_value, $2);
+		if (($1->i_value & 070) < 040)
+			relaxmark('R');
 		emit(1, E_CODE16, $2, $1->i_value);
 	}
 |
@@ -4395,6 +4475,7 @@ struct	item	keytab[] = {
 	{"rary",	0xfd1e,	SHIFT_XY,	VERB | Z80 | ZNONSTD },
 	{"rc",		0330,	NOOPERAND,	VERB | I8080 },
 	{".read",	PSINC,	ARGPSEUDO,	VERB },
+	{".relax",	0,	RELAX,		VERB },
 	{"rept",	0,	REPT,		VERB },
 	{"res",		0145600,BIT,		VERB | Z80 },
 	{"resx",	0xdd86,	BIT_XY,		VERB | Z80 | ZNONSTD },
@@ -4505,11 +4586,16 @@ struct	item	keytab[] = {
 };
 
 /*
- *  user-defined items are tabulated in the following table.
+ *  user-defined items are listed in itemtab in the order they were
+ *  defined and found by name through itemhash.  Both grow as needed;
+ *  the items themselves never move as the parser holds pointers to them.
  */
 
-struct item	itemtab[ITEMTABLESIZE];
-struct item	*itemmax = itemtab+ITEMTABLESIZE;
+struct item	**itemtab;
+int	itemcnt, itemtabmax;
+struct item	**itemhash;
+unsigned int	itemhashsize;
+struct item	*itemnew;	// handed out by the last failed locate()
 
 
 
@@ -4732,6 +4818,7 @@ int lex()
 			param->i_token = MPARM;
 			param->i_string = malloc(strlen(tempbuf) + 1);
 			strcpy(param->i_string, tempbuf);
+			param_index_add(param);
 
 			yylval.itemptr = param;
 			return param->i_token;
@@ -5106,68 +5193,149 @@ int check_keytab()
 		}
 	}
 
+	for (i = 0; i < sizeof(keytab) / sizeof(keytab[0]); i++) {
+		if (keyword(keytab[i].i_string) != &keytab[i]) {
+			printf("keytab error: %s not found by keyword()\n",
+				keytab[i].i_string);
+			return 0;
+		}
+	}
+
 	printf("keytab OK\n");
 
 	return 1;
 }
 
 
-struct item *keyword(char *name)
+// keytab is searched through a perfect hash built on first use.  The
+// hash of a name picks its bucket and each bucket has a seed, found here,
+// which sends all of its names to slots of their own.  Leading '.' are
+// not hashed, as "foo" finds ".foo"; check_keytab() ensures that leaves
+// the names distinct.
+
+#define KEYHASHSIZE	(1024)	/* power of 2, over twice the keywords */
+#define KEYBUCKETS	(128)
+#define NKEYS		((int)(sizeof keytab / sizeof keytab[0]))
+
+short keyslot[KEYHASHSIZE];	/* keytab index + 1, or 0 */
+unsigned short keyseed[KEYBUCKETS];
+int keyhashed;
+
+int keyword_slot(unsigned int hash, unsigned int seed)
 {
-	int  r, l, u;
-	struct item *ip;
+	hash ^= seed * 0x9e3779b9u;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
 
-	/*
-	 *  binary search
-	 */
-	l = 0;
-	u = (sizeof keytab/sizeof keytab[0])-1;
-	while (l <= u) {
-		char *key;
-		i = (l+u)/2;
-		ip = &keytab[i];
-		key = ip->i_string;
-		r = strcmp(name + (name[0] == '.'), key + (key[0] == '.'));
-		if (r == 0) {
-			// Do not allow ".foo" to match "foo"
-			if (name[0] == '.' && key[0] != '.')
-				break;
+	return hash & (KEYHASHSIZE - 1);
+}
+
+void keyword_index()
+{
+	unsigned int hash[NKEYS];
+	int bucket[NKEYS], member[NKEYS], slot[NKEYS];
+	int count[KEYBUCKETS] = { 0 };
+	int b, i, k, n, size, max = 0;
+	unsigned int seed;
 
-			return ip;
+	for (i = 0; i < NKEYS; i++) {
+		char *key = keytab[i].i_string;
+		hash[i] = item_hash(key + (key[0] == '.'));
+		b = bucket[i] = (hash[i] >> 16) % KEYBUCKETS;
+		if (++count[b] > max)
+			max = count[b];
+	}
+
+	// Biggest buckets first while there is the most room.
+	for (size = max; size > 0; size--) {
+		for (b = 0; b < KEYBUCKETS; b++) {
+			if (count[b] != size)
+				continue;
+
+			for (n = 0, i = 0; i < NKEYS; i++)
+				if (bucket[i] == b)
+					member[n++] = i;
+
+			for (seed = 1; seed < 65536; seed++) {
+				for (k = 0; k < n; k++) {
+					slot[k] = keyword_slot(hash[member[k]], seed);
+					if (keyslot[slot[k]])
+						break;
+					keyslot[slot[k]] = member[k] + 1;
+				}
+				if (k == n)
+					break;
+				while (k-- > 0)
+					keyslot[slot[k]] = 0;
+			}
+			if (seed == 65536)
+				error("cannot build keyword hash");
+
+			keyseed[b] = seed;
 		}
-		if (r < 0)
-			u = i-1;
-		else
-			l = i+1;
 	}
 
-	return 0;
+	keyhashed = 1;
 }
 
-// Find 'name' in an item table.  Returns an empty slot if not found.
+struct item *keyword(char *name)
+{
+	unsigned int hash;
+	int i;
+	char *key;
+
+	if (!keyhashed)
+		keyword_index();
+
+	hash = item_hash(name + (name[0] == '.'));
+	i = keyslot[keyword_slot(hash, keyseed[(hash >> 16) % KEYBUCKETS])];
+	if (i == 0)
+		return 0;
+
+	key = keytab[i - 1].i_string;
+	if (strcmp(name + (name[0] == '.'), key + (key[0] == '.')) != 0)
+		return 0;
+
+	// Do not allow ".foo" to match "foo"
+	if (name[0] == '.' && key[0] != '.')
+		return 0;
+
+	return &keytab[i - 1];
+}
+
+// FNV-1a over the lowercased name.  Only 1 caller passes a name which
+// has not already been lowercased, but it is cheap enough to do here.
+
+unsigned int item_hash(char *name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name) {
+		unsigned char ch = *name++;
+		if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+		hash = (hash ^ ch) * 16777619u;
+	}
+
+	return hash;
+}
+
+// Find 'name' in an item table.  Returns an empty slot if not found,
+// with i_hash already set for the caller to fill in.
 // Uses case-independent comparisions which are largely wasted as
 // there is only 1 case where 'name' has not already been lowercased.
 
 struct item *item_lookup(char *name, struct item *table, int table_size)
 {
-	struct item *ip;
-	/*
-	 *  hash into item table
-	 */
-	int hash = 0;
-	char *p = name;
-	while (*p) {
-		char ch = *p++;
-		if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
-		hash += ch;
-	}
-	hash %= table_size;
-	ip = &table[hash];
+	unsigned int hash = item_hash(name);
+	struct item *ip = &table[hash % table_size];
 
 	for (;;) {
-		if (ip->i_token == 0)
+		if (ip->i_token == 0) {
+			ip->i_hash = hash;
 			break;
-		if (ci_strcmp(name, ip->i_string) == 0)
+		}
+		if (ip->i_hash == hash && ci_strcmp(name, ip->i_string) == 0)
 			break;
 		if (++ip >= table + table_size)
 			ip = table;
@@ -5176,31 +5344,170 @@ struct item *item_lookup(char *name, struct item *table, int table_size)
 	return ip;
 }
 
-struct item *locate(char *name)
+void item_hash_insert(struct item *ip)
 {
-	return item_lookup(name, itemtab, ITEMTABLESIZE);
+	unsigned int i = ip->i_hash & (itemhashsize - 1);
+
+	while (itemhash[i])
+		i = (i + 1) & (itemhashsize - 1);
+	itemhash[i] = ip;
 }
 
-// Return the longest token that matches the start of the given name.
-// Currently used for MRAS which will substitute macro parameters inside
-// identifiers.
-struct item *item_substr_lookup(char *name, int token, struct item *table, int table_size)
+// Enter the item handed out by the last failed locate() if it has been
+// filled in since.  Must be done before walking itemtab.
+
+void item_commit()
 {
-	struct item *ip = 0;
 	int i;
 
-	for (i = 0; i < table_size; i++) {
-		unsigned int len;
+	if (!itemnew || !itemnew->i_token)
+		return;
 
-		if (table[i].i_token != token)
-			continue;
+	// Keep a spare entry for compactsymtab()'s end marker.
+	if (itemcnt + 1 >= itemtabmax) {
+		itemtabmax = itemtabmax ? itemtabmax * 2 : 1024;
+		itemtab = realloc(itemtab, itemtabmax * sizeof *itemtab);
+		if (!itemtab)
+			error("out of memory for item table");
+	}
+	itemtab[itemcnt++] = itemnew;
+	itemnew = 0;
+
+	// Keep the hash at most half full.
+	if (itemcnt * 2 > itemhashsize) {
+		free(itemhash);
+		itemhashsize = itemhashsize ? itemhashsize * 2 : 4096;
+		itemhash = calloc(itemhashsize, sizeof *itemhash);
+		if (!itemhash)
+			error("out of memory for item table");
+		for (i = 0; i < itemcnt; i++)
+			item_hash_insert(itemtab[i]);
+	}
+	else
+		item_hash_insert(itemtab[itemcnt - 1]);
+}
+
+// Like item_lookup() on the user-defined items.  An empty item is
+// only entered into the table once it has been given a token.
+
+struct item *locate(char *name)
+{
+	unsigned int hash, i;
+	struct item *ip;
+
+	item_commit();
+
+	hash = item_hash(name);
+	if (itemhashsize) {
+		for (i = hash & (itemhashsize - 1); (ip = itemhash[i]);
+			i = (i + 1) & (itemhashsize - 1))
+		{
+			if (ip->i_hash == hash && ci_strcmp(name, ip->i_string) == 0)
+				return ip;
+		}
+	}
+
+	if (!itemnew) {
+		itemnew = calloc(1, sizeof *itemnew);
+		if (!itemnew)
+			error("out of memory for item table");
+	}
+	itemnew->i_hash = hash;
+
+	return itemnew;
+}
+
+/*
+ *  MRAS will substitute macro parameters at the start of longer
+ *  identifiers, so the parameter names of the macro being defined are
+ *  also kept in a trie.  Node 0 is the root; each node lists its children
+ *  through pn_next and has the parameter whose name ends there, if any.
+ */
+
+struct paramnode {
+	int	pn_char;
+	int	pn_child;
+	int	pn_next;
+	struct item *pn_param;
+};
+
+struct paramnode *paramidx;
+int	paramidxcnt, paramidxmax;
+
+void param_index_add(struct item *param)
+{
+	char *p;
+	int node = 0, n, ch;
+
+	if (!paramidx) {
+		paramidxmax = 64;
+		paramidx = malloc(paramidxmax * sizeof *paramidx);
+		if (!paramidx)
+			error("out of memory for macro parameters");
+		param_index_clear();
+	}
+
+	for (p = param->i_string; *p; p++) {
+		ch = *p;
+		if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+		for (n = paramidx[node].pn_child; n; n = paramidx[n].pn_next)
+			if (paramidx[n].pn_char == ch)
+				break;
 
-		len = strlen(table[i].i_string);
-		if (ci_strcompare(name, table[i].i_string, len) == 0) {
-			if (!ip || len > strlen(ip->i_string)) {
-				ip = table + i;
+		if (!n) {
+			if (paramidxcnt == paramidxmax) {
+				paramidxmax *= 2;
+				paramidx = realloc(paramidx, paramidxmax * sizeof *paramidx);
+				if (!paramidx)
+					error("out of memory for macro parameters");
 			}
+			n = paramidxcnt++;
+			paramidx[n].pn_char = ch;
+			paramidx[n].pn_child = 0;
+			paramidx[n].pn_next = paramidx[node].pn_child;
+			paramidx[n].pn_param = 0;
+			paramidx[node].pn_child = n;
 		}
+		node = n;
+	}
+
+	paramidx[node].pn_param = param;
+}
+
+void param_index_clear()
+{
+	if (!paramidx)
+		return;
+
+	paramidxcnt = 1;
+	paramidx[0].pn_child = 0;
+	paramidx[0].pn_param = 0;
+}
+
+// Return the longest macro parameter that matches the start of the given
+// name.  Currently used for MRAS which will substitute macro parameters
+// inside identifiers.
+struct item *item_substr_lookup(char *name)
+{
+	struct item *ip = 0;
+	int node = 0, n, ch;
+
+	if (!paramidx)
+		return 0;
+
+	for (; *name; name++) {
+		ch = *name;
+		if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+		for (n = paramidx[node].pn_child; n; n = paramidx[n].pn_next)
+			if (paramidx[n].pn_char == ch)
+				break;
+
+		if (!n)
+			break;
+
+		node = n;
+		if (paramidx[node].pn_param)
+			ip = paramidx[node].pn_param;
 	}
 
 	return ip;
@@ -5219,7 +5526,7 @@ struct item *item_substr_lookup(char *name, int token, struct item *table, int t
 
 int tokenofitem(int deftoken, int keyexclude, int keyinclude)
 {
-	struct item *ip;
+	struct item *ip, *key;
 	int  i;
 
 #ifdef T_DEBUG
@@ -5230,14 +5537,18 @@ int tokenofitem(int deftoken, int keyexclude, int keyinclude)
 	// Allow macros to override built-ins
 	// Maybe shouldn't be done for identifiers that will undergo
 	// '.' and '_' expansion.
-	ip = locate(tempbuf);
-	if (ip->i_token == MNAME)
-		goto found;
+	// Keywords need not be looked for unless a macro has taken one.
+	key = keyword(tempbuf);
+	if (!key || keymacros) {
+		ip = locate(tempbuf);
+		if (ip->i_token == MNAME)
+			goto found;
+	}
 
 	if (full_exprs)
 		keyexclude = ~TERM;
 
-	ip = keyword(tempbuf);
+	ip = key;
 	if (ip) {
 		if (ip->i_uses & keyinclude)
 			goto found;
@@ -5272,8 +5583,7 @@ int tokenofitem(int deftoken, int keyexclude, int keyinclude)
 		i = 0 ;
 		goto token_done ;
 	}
-	if (++nitems > ITEMTABLESIZE-20)
-		error("item table overflow");
+	nitems++;
 	ip->i_string = malloc(strlen(tempbuf)+1);
 	ip->i_token = deftoken;
 	ip->i_uses = 0;
@@ -5328,6 +5638,7 @@ void itemcpy(struct item *dst, struct item *src)
 		dst->i_scope = src->i_scope;
 		dst->i_chain = src->i_chain;
 		dst->i_pass = src->i_pass;
+		dst->i_hash = src->i_hash;
 	}
 }
 
@@ -5336,11 +5647,11 @@ void itemcpy(struct item *dst, struct item *src)
  */
 void interchange(int i, int j)
 {
-	struct item temp;
+	struct item *temp;
 
-	itemcpy(&temp, itemtab + i);
-	itemcpy(itemtab + i, itemtab + j);
-	itemcpy(itemtab + j, &temp);
+	temp = itemtab[i];
+	itemtab[i] = itemtab[j];
+	itemtab[j] = temp;
 }
 
 
@@ -5356,10 +5667,10 @@ void custom_qsort(int m, int n)
 		i = m;
 		j = n+1;
 		for (;;) {
-			do i++; while(strcmp(itemtab[i].i_string,
-					itemtab[m].i_string) < 0);
-			do j--; while(strcmp(itemtab[j].i_string,
-					itemtab[m].i_string) > 0);
+			do i++; while(strcmp(itemtab[i]->i_string,
+					itemtab[m]->i_string) < 0);
+			do j--; while(strcmp(itemtab[j]->i_string,
+					itemtab[m]->i_string) > 0);
 			if (i < j) interchange(i, j); else break;
 		}
 		interchange(m, j);
@@ -5376,6 +5687,102 @@ int getcol()
 /*
  *  get the next character
  */
+// Return the text of the file at path, reading it the first time.
+// Files which could not be opened are remembered too, so searching the
+// include path costs nothing after the first pass.
+
+struct srcfile *src_load(char *path)
+{
+	struct srcfile *sf;
+	FILE *fp;
+
+	for (sf = srcfiles; sf; sf = sf->sf_next)
+		if (strcmp(sf->sf_name, path) == 0)
+			return sf->sf_text ? sf : 0;
+
+	sf = calloc(1, sizeof *sf);
+	if (!sf)
+		error("out of memory for source text");
+	sf->sf_name = strdup(path);
+	sf->sf_next = srcfiles;
+	srcfiles = sf;
+
+#ifdef HAVE_MMAP
+	{
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+
+		if (fd < 0)
+			return 0;
+
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void *text = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (text != MAP_FAILED) {
+				close(fd);
+				sf->sf_text = text;
+				sf->sf_len = st.st_size;
+				return sf;
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	if (!(fp = fopen(path, "rb")))
+		return 0;
+
+	for (;;) {
+		int max = sf->sf_len ? sf->sf_len * 2 : 4096;
+		int got;
+
+		sf->sf_text = realloc(sf->sf_text, max);
+		if (!sf->sf_text)
+			error("out of memory for source text");
+		got = fread(sf->sf_text + sf->sf_len, 1, max - sf->sf_len, fp);
+		sf->sf_len += got;
+		if (sf->sf_len < max)
+			break;
+	}
+	fclose(fp);
+
+	return sf;
+}
+
+// Start reading sf at nesting level now_in.
+
+void src_open(struct srcfile *sf)
+{
+	fsrc[now_in] = sf;
+	fpos[now_in] = 0;
+}
+
+int src_getc()
+{
+	struct srcfile *sf = fsrc[now_in];
+
+	if (fpos[now_in] >= sf->sf_len)
+		return EOF;
+
+	return (unsigned char)sf->sf_text[fpos[now_in]++];
+}
+
+// Copy source text up to the end of the line to p, leaving the line
+// ending to src_getc().
+
+unsigned char *src_getline(unsigned char *p)
+{
+	struct srcfile *sf = fsrc[now_in];
+	char *s = sf->sf_text + fpos[now_in];
+	char *end = sf->sf_text + sf->sf_len;
+
+	while (s < end && *s != '\n' && *s != '\r')
+		*p++ = *s++;
+
+	fpos[now_in] = s - sf->sf_text;
+
+	return p;
+}
+
 int nextchar()
 {
 	int c, ch;
@@ -5467,11 +5874,14 @@ int nextchar()
 	}
 	else {
 		for (;;) {
-			ch = nextline_peek != NOPEEK ? nextline_peek : getc(now_file);
+			if (nextline_peek == NOPEEK)
+				p = src_getline(p);
+
+			ch = nextline_peek != NOPEEK ? nextline_peek : src_getc();
 			nextline_peek = NOPEEK;
 
 			if (ch == '\r') {
-				nextline_peek = getc(now_file);
+				nextline_peek = src_getc();
 				if (nextline_peek == '\n')
 					nextline_peek = NOPEEK;
 
@@ -5492,9 +5902,8 @@ int nextchar()
 		/* if EOF, check for include file */
 		if (ch == EOF) {
 			if (now_in) {
-				fclose(fin[now_in]) ;
 				free(src_name[now_in]);
-				now_file = fin[--now_in];
+				now_in--;
 				nextline_peek = linepeek[now_in];
 			}
 			else if (p == inpbuf)
@@ -5734,12 +6143,9 @@ void add_incpath(char *dir)
 	incpath[incpath_cnt++] = strdup(dir);
 }
 
-FILE *open_incpath(char *filename, char *mode, char **path_used)
+void strip_quotes(char *filename)
 {
 	char quote;
-	int i;
-	char path[1024];
-	FILE *fp;
 
 	// Due to the way parsing works the string can be specified
 	// without quotes or will allow quotes but include them.  Instead
@@ -5756,6 +6162,15 @@ FILE *open_incpath(char *filename, char *mode, char **path_used)
 		if (p[-2] == quote)
 			p[-2] = '\0';
 	}
+}
+
+FILE *open_incpath(char *filename, char *mode, char **path_used)
+{
+	int i;
+	char path[1024];
+	FILE *fp;
+
+	strip_quotes(filename);
 
 	// First look for included file in same directory as source file.
 
@@ -5769,6 +6184,7 @@ FILE *open_incpath(char *filename, char *mode, char **path_used)
 
 		if (note_depend && outpass)
 			printf("%s\n", path);
+		note_file(path);
 		return fp;
 	}
 
@@ -5780,6 +6196,7 @@ FILE *open_incpath(char *filename, char *mode, char **path_used)
 				*path_used = strdup(path);
 			if (note_depend && outpass)
 				printf("%s\n", path);
+			note_file(path);
 			return fp;
 		}
 	}
@@ -5790,10 +6207,118 @@ FILE *open_incpath(char *filename, char *mode, char **path_used)
 	fp = fopen(filename, mode);
 	if (fp && path_used)
 		*path_used = strdup(filename);
+	if (fp)
+		note_file(filename);
 
 	return fp;
 }
 
+// open_incpath() for source files, which come from the cache.
+
+struct srcfile *load_incpath(char *filename, char **path_used)
+{
+	int i;
+	char path[1024];
+	struct srcfile *sf;
+
+	strip_quotes(filename);
+
+	strcpy(path, src_name[now_in]);
+	*basename(path) = '\0';
+	strcat(path, filename);
+	sf = src_load(path);
+
+	for (i = 0; !sf && i < incpath_cnt; i++) {
+		sprintf(path, "%s/%s", incpath[i], filename);
+		sf = src_load(path);
+	}
+
+	if (!sf) {
+		strcpy(path, filename);
+		sf = src_load(path);
+	}
+
+	if (note_depend && outpass)
+		printf("%s\n", path);
+
+	if (sf) {
+		*path_used = strdup(path);
+		note_file(path);
+	}
+
+	return sf;
+}
+
+// Remember a file read during the output pass for --depfile.
+
+void note_file(char *path)
+{
+	int i;
+
+	if (!depfile || !outpass)
+		return;
+
+	for (i = 0; i < depcnt; i++)
+		if (strcmp(depnames[i], path) == 0)
+			return;
+
+	if (depcnt == depmax) {
+		depmax = depmax ? depmax * 2 : 16;
+		depnames = realloc(depnames, depmax * sizeof *depnames);
+		if (!depnames)
+			error("out of memory for --depfile");
+	}
+	depnames[depcnt++] = strdup(path);
+}
+
+void put_depname(FILE *fp, char *name)
+{
+	for (; *name; name++) {
+		if (*name == ' ' || *name == '#' || *name == '\\')
+			putc('\\', fp);
+		else if (*name == '$')
+			putc('$', fp);
+		putc(*name, fp);
+	}
+}
+
+// Write "outputs: source includes..." for make or ninja, with an empty
+// rule for each include so that removing one does not stop the build.
+
+void write_depfile()
+{
+	FILE *fp;
+	int i, any = 0;
+
+	if (!(fp = fopen(depfile, "w"))) {
+		fprintf(stderr, "Cannot create file '%s'\n", depfile);
+		return;
+	}
+
+	for (i = 0; i < CNT_OUTF; i++) {
+		if (*outf[i].fpp) {
+			if (any++)
+				putc(' ', fp);
+			put_depname(fp, outf[i].filename);
+		}
+	}
+	fputs(": ", fp);
+	put_depname(fp, src_name[0]);
+	for (i = 0; i < depcnt; i++) {
+		fputs(" \\\n  ", fp);
+		put_depname(fp, depnames[i]);
+	}
+	fputs("\n", fp);
+
+	for (i = 0; i < depcnt; i++) {
+		fputs("\n", fp);
+		put_depname(fp, depnames[i]);
+		fputs(":\n", fp);
+	}
+
+	fclose(fp);
+}
+
 void version()
 {
 	fprintf(stderr, "zmac version " VERSION "        http://48k.ca/zmac.html\n");
@@ -5808,7 +6333,7 @@ void usage(char *msg, char *param)
 	fprintf(stderr, "\n");
 	version();
 	fprintf(stderr, "usage: zmac [-8bcefghijJlLmnopstz] [-I dir] [-Pk=n] file[.z]\n");
-	fprintf(stderr, "other opts: --rel[7] --mras --zmac --dep --help --doc --version\n");
+	fprintf(stderr, "other opts: --rel[7] --relax --mras --zmac --dep --depfile file --batch list --jobs n --help --doc --version\n");
 	fprintf(stderr, "  zmac -h for more detail about options.\n");
 	exit(1);
 }
@@ -5845,17 +6370,140 @@ void help()
 	fprintf(stderr, "   --oo\thex,cmd\toutput only listed file suffix types\n");
 	fprintf(stderr, "   --xo\tlst,cas\tdo not output listed file suffix types\n");
 	fprintf(stderr, "   --dep\tlist files included\n");
+	fprintf(stderr, "   --depfile file\twrite make dependencies of the output files to file\n");
+	fprintf(stderr, "   --batch list\tassemble once per line of list, adding its arguments\n");
+	fprintf(stderr, "   --jobs n\trun up to n --batch assemblies at once\n");
 	fprintf(stderr, "   --mras\tlimited MRAS/EDAS compatibility\n");
 	fprintf(stderr, "   --rel\toutput .rel file only (--rel7 for 7 character symbol names)\n");
 	fprintf(stderr, "   --zmac\tcompatibility with original zmac\n");
+	fprintf(stderr, "   --relax\tmark jumps in .rel output which ld80 --relax may shorten\n");
 	fprintf(stderr, "   --doc\toutput documentation as HTML file\n");
 
 	exit(0);
 }
 
+// --batch list: each line of list holds the arguments of one assembly,
+// which follow the others on the command line.  Every assembly is done
+// by a child process of its own as all of zmac's state is global and
+// has to start out fresh; --jobs n lets up to n of them run at once.
+
+int batch(int argc, char *argv[])
+{
+#ifdef HAVE_FORK
+	char *list = 0, *text = 0, *line, *next, *p, **args;
+	int i, n, len = 0, max = 0, common = 0;
+	int jobs = 1, running = 0, failed = 0, status;
+	FILE *fp;
+
+	args = malloc(argc * sizeof *args);
+	if (!args)
+		error("out of memory for --batch");
+
+	for (i = 0; i < argc; i++) {
+		if (strcmp(argv[i], "--batch") == 0)
+			list = argv[i = getoptarg(argc, argv, i)];
+		else if (strcmp(argv[i], "--jobs") == 0)
+			jobs = atoi(argv[i = getoptarg(argc, argv, i)]);
+		else
+			args[common++] = argv[i];
+	}
+
+	if (jobs < 1)
+		usage("--jobs needs at least 1", 0);
+
+	// Every child gets the keyword hash from here rather than building
+	// its own.
+	keyword_index();
+
+	// The whole list is read before the first fork, as a child leaving
+	// would move the offset of the file it shares with us.
+	if (strcmp(list, "-") == 0)
+		fp = stdin;
+	else if (!(fp = fopen(list, "r")))
+		usage("Cannot open batch file '%s'", list);
+	do {
+		if (len + 1 >= max) {
+			max = max ? max * 2 : 4096;
+			text = realloc(text, max);
+			if (!text)
+				error("out of memory for --batch");
+		}
+		len += fread(text + len, 1, max - len - 1, fp);
+	} while (!feof(fp) && !ferror(fp));
+	text[len] = '\0';
+	if (fp != stdin)
+		fclose(fp);
+
+	args = realloc(args, (common + len / 2 + 2) * sizeof *args);
+	if (!args)
+		error("out of memory for --batch");
+
+	for (line = text; line; line = next) {
+		if ((next = strchr(line, '\n')))
+			*next++ = '\0';
+
+		n = common;
+		for (p = strtok(line, " \t\r"); p; p = strtok(0, " \t\r")) {
+			if (n == common && *p == '#')
+				break;
+			args[n++] = p;
+		}
+		if (n == common)
+			continue;
+		args[n] = 0;
+
+		if (running == jobs) {
+			wait(&status);
+			running--;
+			if (!WIFEXITED(status) || WEXITSTATUS(status))
+				failed = 1;
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		switch (fork()) {
+		case -1:
+			perror("zmac: fork");
+			failed = 1;
+			break;
+		case 0:
+			exit(assemble(n, args));
+		default:
+			running++;
+			continue;
+		}
+		break;
+	}
+
+	while (running > 0) {
+		wait(&status);
+		running--;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	}
+
+	return failed;
+#else
+	usage("--batch is not supported on this system", 0);
+	return 1;
+#endif
+}
+
 int main(int argc, char *argv[])
 {
-	struct item *ip;
+	int i;
+
+	for (i = 1; i < argc; i++)
+		if (strcmp(argv[i], "--batch") == 0)
+			return batch(argc, argv);
+
+	return assemble(argc, argv);
+}
+
+int assemble(int argc, char *argv[])
+{
+	struct item *ip, **ipp;
+	struct srcfile *sf;
 	int  i, j;
 	int  files;
 	int used_o;
@@ -5864,8 +6512,6 @@ int main(int argc, char *argv[])
 	extern  yydebug;
 #endif
 
-	fin[0] = stdin;
-	now_file = stdin;
 	files = 0;
 	used_o = 0;
 	used_oo = 0;
@@ -5897,11 +6543,22 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
+		if (strcmp(argv[i], "--relax") == 0) {
+			default_relaxopt = 1;
+			relax_used = 1;
+			continue;
+		}
+
 		if (strcmp(argv[i], "--dep") == 0) {
 			note_depend = 1;
 			continue;
 		}
 
+		if (strcmp(argv[i], "--depfile") == 0) {
+			depfile = argv[i = getoptarg(argc, argv, i)];
+			continue;
+		}
+
 		if (strcmp(argv[i], "--help") == 0) {
 			help();
 			continue;
@@ -6114,14 +6771,14 @@ int main(int argc, char *argv[])
 		else if (files++ == 0) {
 			sourcef = argv[i];
 			strcpy(src, sourcef);
-			if ((now_file = fopen(src, "r")) == NULL) {
+			if ((sf = src_load(src)) == NULL) {
 				if (!*getsuffix(src))
 					suffix(src, ".z");
-				if ((now_file = fopen(src, "r")) == NULL)
+				if ((sf = src_load(src)) == NULL)
 					usage("Cannot open source file '%s'", src);
 			}
 			now_in = 0;
-			fin[now_in] = now_file ;
+			src_open(sf);
 			src_name[now_in] = src ;
 		} else if (files)
 			usage("Too many arguments", 0);
@@ -6231,7 +6888,6 @@ int main(int argc, char *argv[])
 #ifdef DEBUG
 	fputs("DEBUG-pass 1\n", stderr) ;
 #endif
-	clear();
 	setvars();
 	npass = 1;
 	outpass = 0;
@@ -6250,7 +6906,9 @@ int main(int argc, char *argv[])
 			putrelname(progname);
 		}
 
-		for (ip = itemtab - 1; ++ip < itemmax; ) {
+		item_commit();
+		for (ipp = itemtab; ipp < itemtab + itemcnt; ipp++) {
+			ip = *ipp;
 			// Output list of public labels.  m80 will let
 			// equates and aseg values be public so we do, too.
 			if (outpass && ip->i_token && (ip->i_scope & SCOPE_PUBLIC)) {
@@ -6289,7 +6947,8 @@ int main(int argc, char *argv[])
 			putrelsegref(SEG_CODE, seg_size[SEG_CODE]);
 		}
 
-		for (ip = itemtab - 1; ++ip < itemmax; ) {
+		for (ipp = itemtab; ipp < itemtab + itemcnt; ipp++) {
+			ip = *ipp;
 			if (ip->i_token != COMMON)
 				continue;
 
@@ -6303,13 +6962,12 @@ int main(int argc, char *argv[])
 
 		// In case we hit 'end' inside an included file
 		while (now_in > 0) {
-			fclose(fin[now_in]);
 			free(src_name[now_in]);
-			now_file = fin[--now_in];
+			now_in--;
 			nextline_peek = linepeek[now_in];
 		}
 		setvars();
-		fseek(now_file, (long)0, 0);
+		fpos[0] = 0;
 
 	#ifdef DEBUG
 		fprintf(stderr, "DEBUG- pass %d\n", npass) ;
@@ -6385,9 +7043,10 @@ int main(int argc, char *argv[])
 		putcas(0);
 
 	if (relopt) {
-		struct item *ip;
 		// Output external symbols and value of public symbols
-		for (ip = itemtab; ip < itemmax; ip++) {
+		item_commit();
+		for (ipp = itemtab; ipp < itemtab + itemcnt; ipp++) {
+			ip = *ipp;
 			if (ip->i_token == UNDECLARED && (ip->i_scope & SCOPE_EXTERNAL)) {
 				putrelcmd(RELCMD_EXTCHAIN);
 				// Chain value will have top two bits set appropriately
@@ -6509,9 +7168,11 @@ int main(int argc, char *argv[])
 	writewavs(0, CAS_PAD, CAS_PAD);
 
 	if (fbds) {
-		struct item *tp;
+		struct item *tp, **tpp;
 
-		for (tp = itemtab; tp < itemmax; tp++) {
+		item_commit();
+		for (tpp = itemtab; tpp < itemtab + itemcnt; tpp++) {
+			tp = *tpp;
 			if (tp->i_token == LABEL)
 				fprintf(fbds, "%04x a %s\n", tp->i_value, tp->i_string);
 			else if (tp->i_token == EQUATED)
@@ -6544,6 +7205,8 @@ int main(int argc, char *argv[])
 	clean_outf_temp();
 	if (counterr() > 0)
 		clean_outf();
+	else if (depfile)
+		write_depfile();
 	exit(counterr() > 0);
 }
 
@@ -6673,6 +7336,7 @@ void setvars()
 	njrpromo = 0;
 	jopt = default_jopt;
 	JPopt = default_JPopt;
+	relaxopt = default_relaxopt;
 	strcpy(modstr, "@@@@");
 	segment = SEG_CODE;
 	cur_common = NULL;
@@ -6723,22 +7387,6 @@ void setvars()
 	reset_import();
 }
 
-//
-// Clear out cycle counts and memory.
-//
-
-void clear()
-{
-	int i;
-
-	for (i = 0; i < sizeof(memory) / sizeof(memory[0]); i++)
-	{
-		memory[i] = 0;
-		memflag[i] = 0;
-		tstatesum[i] = 0;
-	}
-}
-
 void setmem(int addr, int value, int type)
 {
 	value &= 0xff;
@@ -6768,33 +7416,37 @@ void error(char *as)
  */
 void compactsymtab()
 {
-	struct item *tp, *fp;
+	static struct item endmark = { "{" };	/* } */
+	struct item **tp, **fp, **end;
 
 	if (!nitems)
 		return;
 
+	item_commit();
+	end = itemtab + itemcnt;
 	tp = itemtab;
 	tp--;
-	for (fp = itemtab; fp<itemmax; fp++) {
-		if (fp->i_token == UNDECLARED && !(fp->i_scope & SCOPE_EXTERNAL)) {
+	for (fp = itemtab; fp<end; fp++) {
+		if ((*fp)->i_token == UNDECLARED && !((*fp)->i_scope & SCOPE_EXTERNAL)) {
 			nitems--;
 			continue;
 		}
-		if (fp->i_token == 0)
+		if ((*fp)->i_token == 0)
 			continue;
 
 		// Don't list macros or internally defined symbols
-		if (fp->i_token == MNAME || (fp->i_scope & SCOPE_BUILTIN)) {
+		if ((*fp)->i_token == MNAME || ((*fp)->i_scope & SCOPE_BUILTIN)) {
 			nitems--;
 			continue;
 		}
 
 		tp++;
-		itemcpy(tp, fp);
+		*tp = *fp;
 	}
 
+	// item_commit() always leaves room for this
 	tp++;
-	tp->i_string = "{";	/* } */
+	*tp = &endmark;
 
 	/*  sort the table */
 	custom_qsort(0, nitems-1);
@@ -6826,7 +7478,7 @@ void putsymtab()
 		for(j=0; j<numcol; j++) {
 			k = rows*j+i;
 			if (k < nitems) {
-				tp = &itemtab[k];
+				tp = itemtab[k];
 				t = tp->i_token;
 				c = ' ' ;
 				if (t == EQUATED || t == DEFLED)
@@ -7041,7 +7693,7 @@ void mlex(char *look)
 
 			// Hmmm, that "item_lookup" is putting crap in the table, yes?
 			if (mras)
-				param = item_substr_lookup(tempbuf, MPARM, paramtab, PARAMTABSIZE);
+				param = item_substr_lookup(tempbuf);
 			else
 				param = item_lookup(tempbuf, paramtab, PARAMTABSIZE);
 
@@ -7161,6 +7813,7 @@ done:
 			paramtab[c].i_token = 0;
 		}
 	}
+	param_index_clear();
 	inmlex = 0;
 #ifdef	M_DEBUG
 	fprintf(stderr,"exit 'mlex' at %d\n", mfptr) ;
@@ -7181,7 +7834,7 @@ void putm_str(char *str, int look_for_param)
 {
 	for (; *str; str++) {
 		if (look_for_param) {
-			struct item *param = item_substr_lookup(str, MPARM, paramtab, PARAMTABSIZE);
+			struct item *param = item_substr_lookup(str);
 			if (param) {
 				putm_param_ref(param);
 				str += strlen(param->i_string) - 1;
@@ -7597,14 +8250,16 @@ void insymtab(char *name)
 void outsymtab(char *name)
 {
 	struct stab *t;
-	struct item *ip;
+	struct item *ip, **ipp;
 	int  i;
 	FILE *sfile;
 
 	t = (struct stab *) tempbuf;
 	if (!(sfile = fopen(name, "wb")))
 		return;
-	for (ip=itemtab; ip<itemmax; ip++) {
+	item_commit();
+	for (ipp=itemtab; ipp<itemtab+itemcnt; ipp++) {
+		ip = *ipp;
 		if (ip->i_token == UNDECLARED) {
 			ip->i_token = 0;
 			nitems--;
@@ -7616,7 +8271,8 @@ void outsymtab(char *name)
 	t->t_token = nitems;
 	fwrite((char *)t, 1, sizeof *t, sfile);
 
-	for (ip=itemtab; ip<itemmax; ip++) {
+	for (ipp=itemtab; ipp<itemtab+itemcnt; ipp++) {
+		ip = *ipp;
 		if (ip->i_token != 0) {
 			t->t_token = ip->i_token;
 			t->t_value = ip->i_value;
@@ -7654,13 +8310,14 @@ void copyname(char *st1, char *st2)
 void next_source(char *sp, int always)
 {
 	char *path;
+	struct srcfile *sf;
 
 	if (!always && imported(sp))
 		return;
 
 	if(now_in == NEST_IN -1)
 		error("Too many nested includes") ;
-	if ((now_file = open_incpath(sp, "r", &path)) == NULL) {
+	if ((sf = load_incpath(sp, &path)) == NULL) {
 		char ebuf[1024] ;
 		sprintf(ebuf,"Can't open include file: %s", sp) ;
 		error(ebuf) ;
@@ -7682,8 +8339,9 @@ void next_source(char *sp, int always)
 
 	linepeek[now_in] = nextline_peek;
 	nextline_peek = NOPEEK;
-	/* save the new file descriptor. */
-	fin[++now_in] = now_file ;
+	/* save the new source. */
+	now_in++;
+	src_open(sf);
 	/* start with line 0 */
 	linein[now_in] = 0 ;
 	/* save away the file name */
@@ -0,0 +1,112 @@
+#!/bin/sh
+# Runs a fixed set of CP/M workloads under the emulator, records the number
+# of instructions and cycles each one takes, and fails if any of them is
+# slower than the checked-in baseline by more than BENCH_THRESHOLD percent
+# (default 2), or isn't in the baseline at all.
+#
+# Usage: bench.sh RESULTS WORKDIR BASELINE EMU ASM COPY STAT DUMP BBCBASIC
+#                 [BBC PROGRAMS...]
+
+set -e
+
+results=$1
+work=$2
+baseline=$3
+emu=$4
+asm=$5
+copy=$6
+stat=$7
+dump=$8
+bbcbasic=$9
+shift 9
+threshold=${BENCH_THRESHOLD:-2}
+
+rm -rf $work
+mkdir -p $work
+: > $results.tmp
+
+# run NAME COMMAND ARGS... < stdin
+run() {
+    name=$1
+    shift
+    if ! $emu -p A=$work --counts=$work/$name.counts "$@" > $work/$name.out; then
+        echo "benchmark $name failed; output is in $work/$name.out" >&2
+        exit 1
+    fi
+    awk -v name=$name '
+        $1 == "instructions" { i = $2 }
+        $1 == "cycles" { c = $2 }
+        END { print name, i, c }' $work/$name.counts >> $results.tmp
+}
+
+# A large 8080 source file for asm.com.
+awk 'BEGIN {
+    print "\torg 100h"
+    for (i = 0; i < 500; i++) {
+        printf "l%d:\tlxi h,l%d\n", i, (i + 1) % 500
+        printf "\tmvi a,%d\n", i % 256
+        print "\tmov b,a"
+        print "\tadd b"
+        print "\tsui 3"
+        printf "\tjnz l%d\n", (i * 7) % 500
+        printf "\tcall l%d\n", (i * 13) % 500
+        print "\tshld 80h"
+        print "\tdb 1, 2, 3, 4, 5, 6, 7, 8"
+        print "\tdw 1234h, 5678h"
+        print "\tret"
+    }
+    print "\tend"
+}' > $work/bench.asm
+run asm $asm bench < /dev/null
+
+# Sequential copy of a multi-megabyte file.
+dd if=/dev/zero of=$work/big.dat bs=1024 count=2048 status=none
+run copy $copy big.dat copy.dat < /dev/null
+
+# A full directory listing.
+i=0
+while [ $i -lt 128 ]; do
+    echo $i > $work/f$i.dat
+    i=$((i + 1))
+done
+run stat $stat '????????.???' < /dev/null
+
+run dump $dump bench.asm < /dev/null
+
+for f in "$@"; do
+    b=$(basename $f .bbc)
+    cp $f $work/$b.bbc
+    echo '*BYE' | run bbc-$b $bbcbasic $b
+done
+
+mv $results.tmp $results
+
+# Compare against the baseline. A workload which isn't in it fails too, as
+# otherwise an empty baseline would never fail anything.
+awk -v threshold=$threshold -v results=$results '
+    FNR == NR {
+        if ($0 !~ /^#/ && NF == 3)
+            base[$1] = $3
+        next
+    }
+    {
+        if (!($1 in base)) {
+            printf "%-16s %14.0f cycles (no baseline)\n", $1, $3
+            missing = 1
+            next
+        }
+        delta = (base[$1] == 0) ? 0 : (100.0 * ($3 - base[$1]) / base[$1])
+        printf "%-16s %14.0f cycles %+7.2f%%\n", $1, $3, delta
+        if (delta > threshold) {
+            printf "%s regressed by more than %s%%\n", $1, threshold
+            failed = 1
+        }
+    }
+    END {
+        if (missing) {
+            printf "Some workloads have no baseline; if these results are\n"
+            printf "right, copy %s over the baseline.\n", results
+            failed = 1
+        }
+        exit failed
+    }' $baseline $results
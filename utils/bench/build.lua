@@ -0,0 +1,38 @@
+-- Runs the benchmark suite; see bench.sh. This isn't part of any make
+-- target until baseline.txt has been generated; see there.
+normalrule {
+    name = "benchmark",
+    ins = {
+        "./bench.sh",
+        "./baseline.txt",
+        "utils/emu+emu",
+        "cpmtools+asm",
+        "cpmtools+copy",
+        "cpmtools+stat",
+        "cpmtools+dump",
+        "third_party/bbcbasic+bbcbasic",
+        "third_party/bbcbasic/examples/sort.bbc",
+        "third_party/bbcbasic/examples/sortreal.bbc",
+    },
+    outleaves = { "results.txt" },
+    commands = {
+        -- The threshold is part of the command so that changing it runs
+        -- the comparison again.
+        "BENCH_THRESHOLD=$(BENCH_THRESHOLD) %{ins[1]} %{outs[1]} %{dir}/work %{ins[2]} %{ins[3]} %{ins[4]} %{ins[5]} %{ins[6]} %{ins[7]} %{ins[8]} %{ins[9]} %{ins[10]}"
+    }
+}
+
+-- Host timing of ld80 linking against a large library; see ld80bench.sh.
+normalrule {
+    name = "ld80bench",
+    ins = {
+        "./ld80bench.sh",
+        "third_party/zmac+zmac",
+        "third_party/ld80+ld80",
+        "third_party/ld80+lib80",
+    },
+    outleaves = { "ld80bench.txt" },
+    commands = {
+        "%{ins[1]} %{outs[1]} %{dir}/work %{ins[2]} %{ins[3]} %{ins[4]}"
+    }
+}
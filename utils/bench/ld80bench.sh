@@ -0,0 +1,106 @@
+#!/bin/sh
+# Times ld80 linking a program against a large generated library, and a
+# module with tens of thousands of external references. Unlike
+# bench.sh this measures host time, so the results are informational only
+# and are never compared against a baseline.
+#
+# Usage: ld80bench.sh RESULTS WORKDIR ZMAC LD80 LIB80
+
+set -e
+
+results=$1
+work=$2
+zmac=$3
+ld80=$4
+lib80=$5
+modules=${BENCH_LD80_MODULES:-1000}
+runs=${BENCH_LD80_RUNS:-5}
+
+rm -rf $work
+mkdir -p $work
+
+# Each library module defines one routine which calls a few later ones, so
+# that a single pass over the library pulls everything in.
+i=0
+: > $work/lib.rel
+while [ $i -lt $modules ]; do
+    awk -v i=$i -v n=$modules 'BEGIN {
+        printf "\tpublic m%d\n", i
+        for (j = 1; j <= 3; j++)
+            if (i + j < n)
+                printf "\textrn m%d\n", i + j
+        printf "m%d:\n", i
+        for (j = 1; j <= 3; j++)
+            if (i + j < n)
+                printf "\tcall m%d\n", i + j
+        for (j = 0; j < 8; j++)
+            printf "\tld hl, m%d + %d\n", i, j
+        print "\tret"
+        print "\tdseg"
+        printf "\tdefs %d\n", i % 17
+    }' > $work/m$i.z80
+    $zmac --zmac -m --rel7 -z -o $work/m$i.rel $work/m$i.z80
+    # A library is the concatenation of its modules, with the end of file
+    # marker removed from all but the last.
+    head -c -1 $work/m$i.rel >> $work/lib.rel
+    i=$((i + 1))
+done
+printf '\236' >> $work/lib.rel
+
+printf '\textrn m0\n\tcall m0\n\tret\n' > $work/main.z80
+$zmac --zmac -m --rel7 -z -o $work/main.rel $work/main.z80
+
+# Only wants the last module of the library.
+printf '\textrn m%d\n\tcall m%d\n\tret\n' $((modules - 1)) $((modules - 1)) \
+    > $work/sparse.z80
+$zmac --zmac -m --rel7 -z -o $work/sparse.rel $work/sparse.z80
+
+: > $results
+
+# External references are chained through the code, one fixup per link;
+# interleaving them with local references keeps plenty of other fixups
+# about.
+awk 'BEGIN {
+    print "\textrn e0, e1, e2, e3"
+    for (i = 0; i < 15000; i++) {
+        printf "l%d:\tdw e%d\n", i, i % 4
+        printf "\tdw l%d\n", i
+    }
+}' > $work/externals.z80
+$zmac --zmac -m --rel7 -z -o $work/externals.rel $work/externals.z80
+printf '\tpublic e0, e1, e2, e3\ne0:\ne1:\ne2:\ne3:\tret\n' > $work/defs.z80
+$zmac --zmac -m --rel7 -z -o $work/defs.rel $work/defs.z80
+
+# timelink NAME DESCRIPTION LD80ARGS...
+timelink() {
+    name=$1
+    description=$2
+    shift 2
+    best=
+    i=0
+    while [ $i -lt $runs ]; do
+        start=$(date +%s%N)
+        $ld80 -O bin -o $work/out.bin -P 100 "$@"
+        end=$(date +%s%N)
+        t=$(( (end - start) / 1000 ))
+        if [ -z "$best" ] || [ $t -lt $best ]; then
+            best=$t
+        fi
+        i=$((i + 1))
+    done
+    echo "$name $description: best of $runs ${best}us" >> $results
+}
+
+library="$modules modules, $(wc -c < $work/lib.rel) bytes"
+
+rm -f $work/lib.rel.idx
+timelink ld80-library "$library" $work/main.rel -l $work/lib.rel
+timelink ld80-library-sparse "$library" $work/sparse.rel -l $work/lib.rel
+
+$lib80 $work/lib.rel
+timelink ld80-library-indexed "$library" $work/main.rel -l $work/lib.rel
+timelink ld80-library-sparse-indexed "$library" $work/sparse.rel -l $work/lib.rel
+
+timelink ld80-externals "30000 references" $work/externals.rel $work/defs.rel
+
+cat $results
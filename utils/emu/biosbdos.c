@@ -21,6 +21,7 @@ static const uint8_t cpm_data[] =
 
 static uint16_t dma;
 static int exitcode = 0;
+static uint32_t transferred; /* bytes moved by the current call, for stats */
 
 struct fcb
 {
@@ -198,7 +199,8 @@ static void bios_const(void)
 static void bios_getchar(void)
 {
 	char c = 0;
-	(void) read(0, &c, 1);
+	if (read(0, &c, 1) == 1)
+		transferred++;
 	if (c == '\n')
 		c = '\r';
 	set_a(c);
@@ -208,6 +210,7 @@ static void bios_putchar(void)
 {
 	char c = get_c();
 	(void) write(1, &c, 1);
+	transferred++;
 }
 
 static void bios_entry(uint8_t bios_call)
@@ -237,6 +240,7 @@ static void bdos_putchar(void)
 {
 	uint8_t c = get_e();
 	(void) write(1, &c, 1);
+	transferred++;
 }
 
 static void bdos_consoleio(void)
@@ -261,6 +265,7 @@ static void bdos_printstring(void)
 		if (c == '$')
 			break;
 		(void) write(1, &c, 1);
+		transferred++;
 	}
 }
 
@@ -277,6 +282,8 @@ void bdos_readline(void)
 	uint16_t de = z80ex_get_reg(z80, regDE);
 	uint8_t maxcount = ram[de+0];
 	int count = read(0, &ram[de+2], maxcount);
+	if (count > 0)
+		transferred += count;
 	if ((count > 0) && (ram[de+2+count-1] == '\n'))
 		count--;
 	ram[de+1] = count;
@@ -412,6 +419,8 @@ static void bdos_readwritesequential(readwrite_cb* readwrite)
 	int here = get_current_record(fcb);
 	int i = readwrite(f, &ram[dma], here);
 	set_current_record(fcb, here+1, file_getrecordcount(f));
+	if (i > 0)
+		transferred += i;
 	if (i == -1)
 		set_result(0xff);
 	else if (i == 0)
@@ -428,6 +437,8 @@ static void bdos_readwriterandom(readwrite_cb* readwrite)
 	struct file* f = file_open(&fcb->filename);
 	int i = readwrite(f, &ram[dma], record);
 	set_current_record(fcb, record, file_getrecordcount(f));
+	if (i > 0)
+		transferred += i;
 	if (i == -1)
 		set_result(0xff);
 	else if (i == 0)
@@ -496,9 +507,15 @@ static void bdos_entry(uint8_t bdos_call)
 
 void biosbdos_entry(int syscall)
 {
-	if (syscall == 0xff)
-		bdos_entry(z80ex_get_reg(z80, regBC));
+	bool bdos = (syscall == 0xff);
+	uint8_t function = bdos ? get_c() : syscall;
+
+	transferred = 0;
+	syscallstats_begin(bdos, function);
+	if (bdos)
+		bdos_entry(function);
 	else
-		bios_entry(syscall);
+		bios_entry(function);
+	syscallstats_end(transferred);
 }
 
@@ -7,23 +7,16 @@ zmac {
     srcs = { "./biosbdos.z80" }
 }
 
+-- Only the top of the memory image is wanted.
 ld80 {
-    name = "biosbdos_memimg",
+    name = "biosbdos_cim",
     srcs = {
+        "--window=f700:",
         "-Pf700", "third_party/zcpr1+zcpr",
         "-Pff00", "+biosbdos_rel"
     }
 }
 
-normalrule {
-    name = "biosbdos_cim",
-    ins = { "+biosbdos_memimg" },
-    outleaves = { "biosbdos.cim" },
-    commands = {
-        "dd if=%{ins[1]} of=%{outs} status=none bs=1 skip=63232"
-    }
-}
-
 objectifyc {
     name = "biosbdos_cim_h",
     srcs = { "+biosbdos_cim" }
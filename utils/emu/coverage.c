@@ -0,0 +1,263 @@
+#define _POSIX_C_SOURCE 200809
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include "globals.h"
+
+/* Records which bytes of the address space the guest executes, reads and
+ * writes. The binary dump is:
+ *
+ *   8 bytes     magic, "Z80COV01"
+ *   8192 bytes  executed bitmap (opcode fetches; bit n&7 of byte n>>3)
+ *   8192 bytes  read bitmap (all other memory reads)
+ *   8192 bytes  written bitmap
+ *   65536 x 4   opcode fetch count per address, little-endian
+ *
+ * An lcov tracefile can also be produced by mapping zmac listings back onto
+ * the executed map; each listing is supplied along with the address its code
+ * segment was linked at. */
+
+#define MAX_LISTINGS 32
+
+struct listing
+{
+	const char* filename;
+	uint16_t base;
+};
+
+struct lcovline
+{
+	const char* filename;
+	int line;
+	uint32_t count;
+};
+
+bool coverage_enabled = false;
+
+static uint8_t executed[0x10000 / 8];
+static uint8_t read_map[0x10000 / 8];
+static uint8_t written[0x10000 / 8];
+static uint32_t hits[0x10000];
+
+static const char* binary_filename;
+static const char* lcov_filename;
+static struct listing listings[MAX_LISTINGS];
+static int num_listings;
+
+static struct lcovline* lcovlines;
+static int num_lcovlines;
+static int max_lcovlines;
+
+void coverage_read(uint16_t address, bool m1)
+{
+	if (m1)
+	{
+		executed[address >> 3] |= 1 << (address & 7);
+		hits[address]++;
+	}
+	else
+		read_map[address >> 3] |= 1 << (address & 7);
+}
+
+void coverage_write(uint16_t address)
+{
+	written[address >> 3] |= 1 << (address & 7);
+}
+
+static void write_binary(void)
+{
+	FILE* fp = fopen(binary_filename, "wb");
+	if (!fp)
+	{
+		perror(binary_filename);
+		return;
+	}
+
+	fwrite("Z80COV01", 1, 8, fp);
+	fwrite(executed, 1, sizeof(executed), fp);
+	fwrite(read_map, 1, sizeof(read_map), fp);
+	fwrite(written, 1, sizeof(written), fp);
+	for (int i = 0; i < 0x10000; i++)
+	{
+		uint32_t v = hits[i];
+		uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+		fwrite(b, 1, 4, fp);
+	}
+	fclose(fp);
+}
+
+static void add_lcovline(const char* filename, int line, uint32_t count)
+{
+	if (num_lcovlines == max_lcovlines)
+	{
+		max_lcovlines = max_lcovlines ? (max_lcovlines * 2) : 1024;
+		lcovlines = realloc(lcovlines, max_lcovlines * sizeof(struct lcovline));
+		if (!lcovlines)
+			fatal("out of memory");
+	}
+
+	struct lcovline* l = &lcovlines[num_lcovlines++];
+	l->filename = filename;
+	l->line = line;
+	l->count = count;
+}
+
+static int compare_lcovlines(const void* p1, const void* p2)
+{
+	const struct lcovline* l1 = p1;
+	const struct lcovline* l2 = p2;
+	int i = strcmp(l1->filename, l2->filename);
+	if (i)
+		return i;
+	return l1->line - l2->line;
+}
+
+/* Listing lines look like:
+ *
+ *   "  12:  175+4\t0031' AF      \t\txor a"
+ *
+ * The field after the line number is "-" for anything which isn't an
+ * instruction; the address is followed by ' for code segment addresses,
+ * " and ! for data and common, and a space when absolute. A "**** filename
+ * ****" line is written whenever an include starts or finishes, but never
+ * before the first line of the top level source; so that is named after
+ * the last such line seen (or the listing itself, if there are none). */
+static void read_listing(struct listing* listing)
+{
+	FILE* fp = fopen(listing->filename, "r");
+	if (!fp)
+		fatal("could not open listing '%s'", listing->filename);
+
+	int first = num_lcovlines;
+	const char* currentfile = NULL;
+	char buffer[1024];
+	while (fgets(buffer, sizeof(buffer), fp))
+	{
+		if (strncmp(buffer, "**** ", 5) == 0)
+		{
+			char* end = strstr(buffer+5, " ****");
+			if (end)
+			{
+				*end = '\0';
+				currentfile = strdup(buffer+5);
+			}
+			continue;
+		}
+
+		int line;
+		int n = 0;
+		if ((sscanf(buffer, "%d:%n", &line, &n) != 1) || !n)
+			continue;
+
+		char* p = buffer + n;
+		while (*p == ' ')
+			p++;
+		if (!isdigit(*p) || !strchr(p, '\t'))
+			continue;
+		p = strchr(p, '\t') + 1;
+
+		char* end;
+		unsigned long address = strtoul(p, &end, 16);
+		if (end != p+4)
+			continue;
+		if (*end == '\'')
+			address = (address + listing->base) & 0xffff;
+		else if (*end != ' ')
+			continue;
+
+		add_lcovline(currentfile, line, hits[address]);
+	}
+	fclose(fp);
+
+	const char* topfile = currentfile ? currentfile : strdup(listing->filename);
+	for (int i = first; (i < num_lcovlines) && !lcovlines[i].filename; i++)
+		lcovlines[i].filename = topfile;
+}
+
+static void write_lcov(void)
+{
+	for (int i = 0; i < num_listings; i++)
+		read_listing(&listings[i]);
+	qsort(lcovlines, num_lcovlines, sizeof(struct lcovline), compare_lcovlines);
+
+	FILE* fp = fopen(lcov_filename, "w");
+	if (!fp)
+	{
+		perror(lcov_filename);
+		return;
+	}
+
+	fprintf(fp, "TN:\n");
+	int i = 0;
+	while (i < num_lcovlines)
+	{
+		const char* filename = lcovlines[i].filename;
+		int found = 0;
+		int hit = 0;
+
+		fprintf(fp, "SF:%s\n", filename);
+		while ((i < num_lcovlines) && (strcmp(lcovlines[i].filename, filename) == 0))
+		{
+			/* Lines emitted more than once (macros, shared includes) are summed. */
+			int line = lcovlines[i].line;
+			uint64_t count = 0;
+			while ((i < num_lcovlines) && (lcovlines[i].line == line)
+					&& (strcmp(lcovlines[i].filename, filename) == 0))
+				count += lcovlines[i++].count;
+
+			fprintf(fp, "DA:%d,%llu\n", line, (unsigned long long) count);
+			found++;
+			if (count)
+				hit++;
+		}
+		fprintf(fp, "LF:%d\n", found);
+		fprintf(fp, "LH:%d\n", hit);
+		fprintf(fp, "end_of_record\n");
+	}
+
+	fclose(fp);
+}
+
+static void coverage_dump(void)
+{
+	if (binary_filename)
+		write_binary();
+	if (lcov_filename)
+		write_lcov();
+}
+
+static void coverage_enable(void)
+{
+	if (!coverage_enabled)
+	{
+		coverage_enabled = true;
+		atexit(coverage_dump);
+	}
+}
+
+void coverage_set_binary(const char* filename)
+{
+	coverage_enable();
+	binary_filename = filename;
+}
+
+void coverage_set_lcov(const char* filename)
+{
+	coverage_enable();
+	lcov_filename = filename;
+}
+
+void coverage_add_listing(const char* spec)
+{
+	const char* at = strrchr(spec, '@');
+	if (!at)
+		fatal("listing must be specified as FILE@ADDRESS");
+	if (num_listings == MAX_LISTINGS)
+		fatal("too many listings");
+
+	struct listing* listing = &listings[num_listings++];
+	listing->filename = strndup(spec, at - spec);
+	listing->base = strtoul(at+1, NULL, 16);
+}
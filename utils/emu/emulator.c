@@ -10,6 +10,8 @@
 
 Z80EX_CONTEXT* z80;
 uint8_t ram[0x10000];
+uint64_t cycles = 0;
+uint64_t instructions = 0;
 
 struct watchpoint
 {
@@ -27,6 +29,8 @@ static bool bdosbreak = false;
 
 static uint8_t read_cb(Z80EX_CONTEXT* z80, uint16_t addr, int m1_state, void* data)
 {
+	if (coverage_enabled)
+		coverage_read(addr, m1_state);
 	return ram[addr];
 }
 
@@ -37,16 +41,26 @@ static uint8_t dasm_read_cb(uint16_t addr, void* data)
 
 static void write_cb(Z80EX_CONTEXT* z80, uint16_t addr, uint8_t value, void* data)
 {
+	if (coverage_enabled)
+		coverage_write(addr);
 	ram[addr] = value;
 }
 
 static uint8_t ioread_cb(Z80EX_CONTEXT* z80, uint16_t addr, void* data)
 {
+	if ((addr & 0xff) == PERF_PORT)
+		return perfport_read(addr >> 8);
 	return 0;
 }
 
 static void iowrite_cb(Z80EX_CONTEXT* z80, uint16_t addr, uint8_t value, void* data)
 {
+	if ((addr & 0xff) == PERF_PORT)
+	{
+		perfport_write(value);
+		return;
+	}
+
 	biosbdos_entry(addr & 0xff);
 	if (bdosbreak)
 		singlestepping = true;
@@ -397,7 +411,12 @@ void emulator_run(void)
 		else if (tracing)
 			showregs();
 
-		z80ex_step(z80);
+		int tstates = z80ex_step(z80);
+		cycles += tstates;
+		if (!z80ex_last_op_type(z80))
+			instructions++;
+		if (opstats_enabled)
+			opstats_step(pc, tstates);
 	}
 }
 
@@ -6,6 +6,8 @@
 
 extern Z80EX_CONTEXT* z80;
 extern uint8_t ram[0x10000];
+extern uint64_t cycles;
+extern uint64_t instructions;
 
 extern void emulator_init(void);
 extern void emulator_run(void);
@@ -36,6 +38,27 @@ extern int file_findnext(cpm_filename_t* result);
 extern int file_delete(cpm_filename_t* pattern);
 extern int file_rename(cpm_filename_t* src, cpm_filename_t* dest);
 
+extern void syscallstats_init(const char* filename);
+extern void syscallstats_begin(bool bdos, uint8_t function);
+extern void syscallstats_end(uint32_t bytes);
+
+extern bool coverage_enabled;
+extern void coverage_read(uint16_t address, bool m1);
+extern void coverage_write(uint16_t address);
+extern void coverage_set_binary(const char* filename);
+extern void coverage_set_lcov(const char* filename);
+extern void coverage_add_listing(const char* spec);
+
+extern bool opstats_enabled;
+extern void opstats_init(const char* filename);
+extern void opstats_set_range(const char* spec);
+extern void opstats_step(uint16_t pc, int tstates);
+
+#define PERF_PORT 0xfd
+extern void perfport_set_name(const char* spec);
+extern void perfport_write(uint8_t id);
+extern uint8_t perfport_read(uint8_t index);
+
 extern void fatal(const char* message, ...);
 
 extern bool flag_enter_debugger;
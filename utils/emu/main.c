@@ -8,6 +8,7 @@
 
 bool flag_enter_debugger = false;
 char* const* user_command_line = NULL;
+static const char* counts_filename = NULL;
 
 void fatal(const char* message, ...)
 {
@@ -19,12 +20,45 @@ void fatal(const char* message, ...)
 	exit(1);
 }
 
+static void write_counts(void)
+{
+	FILE* fp = fopen(counts_filename, "w");
+	if (!fp)
+	{
+		perror(counts_filename);
+		return;
+	}
+	fprintf(fp, "instructions %llu\n", (unsigned long long) instructions);
+	fprintf(fp, "cycles %llu\n", (unsigned long long) cycles);
+	fclose(fp);
+}
+
 static void syntax(void)
 {
 	printf("cpm [<flags>] [command] [args]:\n");
 	printf("  -h             this help\n");
 	printf("  -d             enter debugger on startup\n");
 	printf("  -p DRIVE=PATH  map a drive to a path (by default, A=.)\n");
+	printf("  --counts=FILE  on exit, write the number of instructions and cycles\n");
+	printf("                 executed to FILE\n");
+	printf("  --syscall-stats=FILE\n");
+	printf("                 on exit, write BIOS/BDOS call statistics to FILE as\n");
+	printf("                 JSON and print a summary table to stderr\n");
+	printf("  --coverage=FILE\n");
+	printf("                 on exit, write executed/read/written memory maps and\n");
+	printf("                 per-address execution counts to FILE\n");
+	printf("  --lcov=FILE    on exit, write an lcov tracefile for the listings below\n");
+	printf("  --listing=LST@ADDR\n");
+	printf("                 map the zmac listing LST, whose code segment was linked\n");
+	printf("                 at hex ADDR, into the lcov output (may be repeated)\n");
+	printf("  --opcode-stats=FILE\n");
+	printf("                 on exit, write executed opcode, opcode pair and opcode\n");
+	printf("                 class statistics to FILE as JSON\n");
+	printf("  --opcode-range=START:END\n");
+	printf("                 only count instructions between these hex addresses\n");
+	printf("  --perf-region=ID=NAME\n");
+	printf("                 name a region timed through the performance counter\n");
+	printf("                 port (0x%02x) in the report printed on exit\n", PERF_PORT);
 	printf("If command is specified, a Unix file of that name will be loaded and\n");
 	printf("injected directly into memory (it's not loaded through the CCP).\n");
 	printf("Arguments may also be provided, but note that any FCBs aren't set up,\n");
@@ -32,15 +66,74 @@ static void syntax(void)
 	exit(1);
 }
 
+enum
+{
+	OPT_COUNTS = 256,
+	OPT_SYSCALL_STATS,
+	OPT_COVERAGE,
+	OPT_LCOV,
+	OPT_LISTING,
+	OPT_PERF_REGION,
+	OPT_OPCODE_STATS,
+	OPT_OPCODE_RANGE,
+};
+
+static const struct option long_options[] =
+{
+	{ "counts",        required_argument, NULL, OPT_COUNTS },
+	{ "syscall-stats", required_argument, NULL, OPT_SYSCALL_STATS },
+	{ "coverage",      required_argument, NULL, OPT_COVERAGE },
+	{ "lcov",          required_argument, NULL, OPT_LCOV },
+	{ "listing",       required_argument, NULL, OPT_LISTING },
+	{ "perf-region",   required_argument, NULL, OPT_PERF_REGION },
+	{ "opcode-stats",  required_argument, NULL, OPT_OPCODE_STATS },
+	{ "opcode-range",  required_argument, NULL, OPT_OPCODE_RANGE },
+	{ NULL, 0, NULL, 0 }
+};
+
 static void parse_options(int argc, char* const* argv)
 {
 	for (;;)
 	{
-		switch (getopt(argc, argv, "hdp:"))
+		switch (getopt_long(argc, argv, "hdp:", long_options, NULL))
 		{
 			case -1:
 				goto end_of_flags;
 
+			case OPT_COUNTS:
+				if (!counts_filename)
+					atexit(write_counts);
+				counts_filename = optarg;
+				break;
+
+			case OPT_SYSCALL_STATS:
+				syscallstats_init(optarg);
+				break;
+
+			case OPT_COVERAGE:
+				coverage_set_binary(optarg);
+				break;
+
+			case OPT_LCOV:
+				coverage_set_lcov(optarg);
+				break;
+
+			case OPT_LISTING:
+				coverage_add_listing(optarg);
+				break;
+
+			case OPT_PERF_REGION:
+				perfport_set_name(optarg);
+				break;
+
+			case OPT_OPCODE_STATS:
+				opstats_init(optarg);
+				break;
+
+			case OPT_OPCODE_RANGE:
+				opstats_set_range(optarg);
+				break;
+
 			case 'd':
 				flag_enter_debugger = true;
 				break;
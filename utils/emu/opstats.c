@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <z80ex/z80ex_dasm.h>
+#include "globals.h"
+
+/* Opcode mix statistics. Each executed instruction is keyed by its opcode
+ * table and opcode byte; z80ex executes DD and FD prefixes as separate steps,
+ * so their cycles are folded into the instruction which follows. */
+
+enum
+{
+	TABLE_BASE,
+	TABLE_CB,
+	TABLE_ED,
+	TABLE_DD,
+	TABLE_FD,
+	TABLE_DDCB,
+	TABLE_FDCB,
+	TABLES
+};
+
+#define KEYS (TABLES * 0x100)
+#define MAX_PAIRS 1000
+
+struct opcode
+{
+	uint64_t count;
+	uint64_t tstates;
+};
+
+struct class
+{
+	char name[8];
+	uint64_t count;
+	uint64_t tstates;
+};
+
+struct pair
+{
+	uint32_t key;
+	uint32_t count;
+};
+
+bool opstats_enabled = false;
+
+static const char* filename;
+static uint16_t range_start = 0x0000;
+static uint16_t range_end = 0xffff;
+
+static struct opcode opcodes[KEYS];
+static uint32_t* pairs;
+static int current_key = -1;
+static int previous_key = -1;
+static bool in_prefix = false;
+
+static const char* const table_prefixes[TABLES] =
+{
+	"", "cb ", "ed ", "dd ", "fd ", "dd cb ", "fd cb "
+};
+
+static int decode_key(uint16_t pc)
+{
+	uint8_t b0 = ram[pc];
+	uint8_t b1 = ram[(uint16_t)(pc+1)];
+	switch (b0)
+	{
+		case 0xcb: return TABLE_CB*0x100 + b1;
+		case 0xed: return TABLE_ED*0x100 + b1;
+
+		case 0xdd:
+		case 0xfd:
+		{
+			bool ix = (b0 == 0xdd);
+			if (b1 == 0xcb)
+				return (ix ? TABLE_DDCB : TABLE_FDCB)*0x100 + ram[(uint16_t)(pc+3)];
+			return (ix ? TABLE_DD : TABLE_FD)*0x100 + b1;
+		}
+	}
+	return TABLE_BASE*0x100 + b0;
+}
+
+/* Builds a representative byte sequence for a key, with zero operands. */
+static void encode_key(int key, uint8_t* bytes)
+{
+	int table = key >> 8;
+	uint8_t op = key;
+
+	memset(bytes, 0, 4);
+	switch (table)
+	{
+		case TABLE_BASE: bytes[0] = op; break;
+		case TABLE_CB:   bytes[0] = 0xcb; bytes[1] = op; break;
+		case TABLE_ED:   bytes[0] = 0xed; bytes[1] = op; break;
+		case TABLE_DD:   bytes[0] = 0xdd; bytes[1] = op; break;
+		case TABLE_FD:   bytes[0] = 0xfd; bytes[1] = op; break;
+		case TABLE_DDCB: bytes[0] = 0xdd; bytes[1] = 0xcb; bytes[3] = op; break;
+		case TABLE_FDCB: bytes[0] = 0xfd; bytes[1] = 0xcb; bytes[3] = op; break;
+	}
+}
+
+static uint8_t key_read_cb(uint16_t addr, void* data)
+{
+	const uint8_t* bytes = data;
+	return (addr < 4) ? bytes[addr] : 0;
+}
+
+static void disassemble_key(int key, char* buffer, int size)
+{
+	uint8_t bytes[4];
+	int tstates;
+	encode_key(key, bytes);
+	z80ex_dasm(buffer, size, 0, &tstates, &tstates, key_read_cb, 0, bytes);
+	for (char* p = buffer; *p; p++)
+		*p = tolower(*p);
+}
+
+static void print_key(FILE* fp, int key)
+{
+	fprintf(fp, "\"%s%02x\"", table_prefixes[key >> 8], key & 0xff);
+}
+
+static int compare_pairs(const void* p1, const void* p2)
+{
+	const struct pair* a = p1;
+	const struct pair* b = p2;
+	if (a->count != b->count)
+		return (a->count < b->count) ? 1 : -1;
+	return (a->key < b->key) ? -1 : (a->key > b->key);
+}
+
+static int compare_classes(const void* p1, const void* p2)
+{
+	const struct class* a = p1;
+	const struct class* b = p2;
+	return strcmp(a->name, b->name);
+}
+
+static void opstats_dump(void)
+{
+	FILE* fp = fopen(filename, "w");
+	if (!fp)
+	{
+		perror(filename);
+		return;
+	}
+
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"range\": [ %d, %d ],\n", range_start, range_end);
+
+	/* Individual opcodes, in opcode table order. */
+
+	static struct class classes[KEYS];
+	int num_classes = 0;
+	bool first = true;
+	fprintf(fp, "\t\"opcodes\": [");
+	for (int key = 0; key < KEYS; key++)
+	{
+		struct opcode* o = &opcodes[key];
+		if (!o->count)
+			continue;
+
+		char mnemonic[64];
+		disassemble_key(key, mnemonic, sizeof(mnemonic));
+
+		fprintf(fp, "%s\n\t\t{ \"opcode\": ", first ? "" : ",");
+		print_key(fp, key);
+		fprintf(fp, ", \"mnemonic\": \"%s\", \"count\": %llu, \"tstates\": %llu }",
+			mnemonic,
+			(unsigned long long) o->count,
+			(unsigned long long) o->tstates);
+		first = false;
+
+		/* The class is the bare mnemonic. */
+
+		char name[sizeof(classes[0].name)] = { 0 };
+		for (int i = 0; (i < sizeof(name)-1) && mnemonic[i] && !isspace(mnemonic[i]); i++)
+			name[i] = mnemonic[i];
+
+		int c = 0;
+		while ((c < num_classes) && (strcmp(classes[c].name, name) != 0))
+			c++;
+		if (c == num_classes)
+		{
+			strcpy(classes[c].name, name);
+			num_classes++;
+		}
+		classes[c].count += o->count;
+		classes[c].tstates += o->tstates;
+	}
+	fprintf(fp, "\n\t],\n");
+
+	qsort(classes, num_classes, sizeof(*classes), compare_classes);
+	fprintf(fp, "\t\"classes\": [");
+	for (int c = 0; c < num_classes; c++)
+		fprintf(fp, "%s\n\t\t{ \"class\": \"%s\", \"count\": %llu, \"tstates\": %llu }",
+			c ? "," : "",
+			classes[c].name,
+			(unsigned long long) classes[c].count,
+			(unsigned long long) classes[c].tstates);
+	fprintf(fp, "\n\t],\n");
+
+	/* The most common pairs, most frequent first. */
+
+	int num_pairs = 0;
+	for (uint32_t i = 0; i < KEYS*KEYS; i++)
+		if (pairs[i])
+			num_pairs++;
+	struct pair* sorted = calloc(num_pairs ? num_pairs : 1, sizeof(struct pair));
+	if (!sorted)
+		fatal("out of memory");
+	num_pairs = 0;
+	for (uint32_t i = 0; i < KEYS*KEYS; i++)
+		if (pairs[i])
+		{
+			sorted[num_pairs].key = i;
+			sorted[num_pairs].count = pairs[i];
+			num_pairs++;
+		}
+	qsort(sorted, num_pairs, sizeof(struct pair), compare_pairs);
+	if (num_pairs > MAX_PAIRS)
+		num_pairs = MAX_PAIRS;
+
+	fprintf(fp, "\t\"pairs\": [");
+	for (int i = 0; i < num_pairs; i++)
+	{
+		fprintf(fp, "%s\n\t\t{ \"first\": ", i ? "," : "");
+		print_key(fp, sorted[i].key / KEYS);
+		fprintf(fp, ", \"second\": ");
+		print_key(fp, sorted[i].key % KEYS);
+		fprintf(fp, ", \"count\": %u }", sorted[i].count);
+	}
+	fprintf(fp, "\n\t]\n}\n");
+
+	free(sorted);
+	fclose(fp);
+}
+
+void opstats_init(const char* file)
+{
+	filename = file;
+	pairs = calloc(KEYS*KEYS, sizeof(uint32_t));
+	if (!pairs)
+		fatal("out of memory");
+
+	opstats_enabled = true;
+	atexit(opstats_dump);
+}
+
+void opstats_set_range(const char* spec)
+{
+	char* end;
+	range_start = strtoul(spec, &end, 16);
+	if (*end != ':')
+		fatal("address range must be specified as START:END");
+	range_end = strtoul(end+1, NULL, 16);
+}
+
+/* Called after each z80ex step, with the PC it started at. */
+void opstats_step(uint16_t pc, int tstates)
+{
+	if (!in_prefix)
+	{
+		if ((pc >= range_start) && (pc <= range_end))
+			current_key = decode_key(pc);
+		else
+		{
+			current_key = -1;
+			previous_key = -1;
+		}
+	}
+
+	in_prefix = !!z80ex_last_op_type(z80);
+	if (current_key == -1)
+		return;
+
+	opcodes[current_key].tstates += tstates;
+	if (in_prefix)
+		return;
+
+	opcodes[current_key].count++;
+	if (previous_key != -1)
+		pairs[previous_key*KEYS + current_key]++;
+	previous_key = current_key;
+}
@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "globals.h"
+
+/* Guest-visible performance counters on PERF_PORT.
+ *
+ * Writing a region id starts timing that region; writing the same id again
+ * stops it and accumulates the elapsed cycles. Regions may nest or overlap
+ * freely.
+ *
+ * Reading returns the cycle counter a byte at a time, selected by the high
+ * byte of the port address (so B for IN r,(C) and A for IN A,(n)). Reading
+ * byte 0 latches the counter, so that bytes 1 to 3 are consistent with it:
+ *
+ *     xor a
+ *     in a, (PERF_PORT)   ; latch, and read bits 0-7
+ *     ld a, 1
+ *     in a, (PERF_PORT)   ; bits 8-15
+ */
+
+struct region
+{
+	const char* name;
+	bool running;
+	uint64_t started;
+	uint64_t calls;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+
+static struct region regions[0x100];
+static uint32_t latched;
+static bool used = false;
+
+static void perfport_dump(void)
+{
+	fflush(stdout);
+	fprintf(stderr, "\n%3s %-20s %10s %10s %10s %10s %14s\n",
+		"id", "region", "calls", "min", "avg", "max", "total");
+	for (int i = 0; i < 0x100; i++)
+	{
+		struct region* r = &regions[i];
+		if (!r->calls)
+			continue;
+
+		fprintf(stderr, "%3d %-20s %10llu %10llu %10llu %10llu %14llu\n",
+			i, r->name ? r->name : "",
+			(unsigned long long) r->calls,
+			(unsigned long long) r->min,
+			(unsigned long long) (r->total / r->calls),
+			(unsigned long long) r->max,
+			(unsigned long long) r->total);
+	}
+}
+
+static void perfport_use(void)
+{
+	if (!used)
+	{
+		used = true;
+		atexit(perfport_dump);
+	}
+}
+
+void perfport_set_name(const char* spec)
+{
+	char* end;
+	unsigned long id = strtoul(spec, &end, 0);
+	if ((*end != '=') || (id > 0xff))
+		fatal("region name must be specified as ID=NAME");
+
+	regions[id].name = strdup(end+1);
+}
+
+void perfport_write(uint8_t id)
+{
+	struct region* r = &regions[id];
+
+	perfport_use();
+	if (!r->running)
+	{
+		r->running = true;
+		r->started = cycles;
+		return;
+	}
+
+	uint64_t elapsed = cycles - r->started;
+	r->running = false;
+	if (!r->calls || (elapsed < r->min))
+		r->min = elapsed;
+	if (elapsed > r->max)
+		r->max = elapsed;
+	r->total += elapsed;
+	r->calls++;
+}
+
+uint8_t perfport_read(uint8_t index)
+{
+	if (index == 0)
+		latched = cycles;
+	return latched >> ((index & 3) * 8);
+}
@@ -0,0 +1,206 @@
+#define _POSIX_C_SOURCE 199309
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "globals.h"
+
+/* Per-call accounting for the BIOS and BDOS entry points. Everything is
+ * keyed by (bdos, function number); host time is measured around the
+ * handler, Z80 time is the number of cycles executed since the previous
+ * system call returned (i.e. the computation which led up to this call). */
+
+#define BUCKETS 32
+
+struct callstats
+{
+	uint64_t calls;
+	uint64_t bytes;
+	uint64_t host_ns;
+	uint64_t cycles_before;
+	uint64_t histogram[BUCKETS]; /* log2 of host ns per call */
+};
+
+static bool enabled = false;
+static const char* json_filename;
+static struct callstats bios_stats[0x100];
+static struct callstats bdos_stats[0x100];
+
+static struct callstats* current;
+static uint64_t call_start_ns;
+static uint64_t last_return_cycles;
+static uint64_t run_start_ns;
+
+static const char* const bios_names[] =
+{
+	[0] = "boot", "wboot", "const", "conin", "conout", "list", "punch",
+	"reader", "home", "seldsk", "settrk", "setsec", "setdma", "read",
+	"write",
+	[0xfe] = "exit",
+};
+
+static const char* const bdos_names[] =
+{
+	[0] = "reset", "conin", "conout", "auxin", "auxout", "lstout",
+	"conio", "getiobyte", "setiobyte", "printstring", "readline",
+	"conststatus", "getversion", "resetdisk", "selectdisk", "open",
+	"close", "findfirst", "findnext", "delete", "readseq", "writeseq",
+	"make", "rename", "getloginvec", "getdisk", "setdma", "getalloc",
+	"writeprotect", "getrovec", "setattrs", "getdpb", "getsetuser",
+	"readrand", "writerand", "filesize", "setrandrec", "resetdrive",
+	[40] = "writerandzf",
+	[45] = "seterrmode",
+	[108] = "setexitcode",
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static int log2_bucket(uint64_t value)
+{
+	int bucket = 0;
+	while (value > 1)
+	{
+		value >>= 1;
+		bucket++;
+	}
+	return (bucket >= BUCKETS) ? (BUCKETS-1) : bucket;
+}
+
+static const char* call_name(bool bdos, int function)
+{
+	const char* const* names = bdos ? bdos_names : bios_names;
+	int count = bdos
+		? sizeof(bdos_names)/sizeof(*bdos_names)
+		: sizeof(bios_names)/sizeof(*bios_names);
+	if ((function < count) && names[function])
+		return names[function];
+	return "?";
+}
+
+static void write_json(FILE* fp, uint64_t total_ns, uint64_t syscall_ns)
+{
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"cycles\": %llu,\n", (unsigned long long) cycles);
+	fprintf(fp, "\t\"host_ns\": %llu,\n", (unsigned long long) total_ns);
+	fprintf(fp, "\t\"syscall_host_ns\": %llu,\n", (unsigned long long) syscall_ns);
+	fprintf(fp, "\t\"calls\": [");
+
+	bool first = true;
+	for (int bdos = 0; bdos < 2; bdos++)
+	{
+		struct callstats* table = bdos ? bdos_stats : bios_stats;
+		for (int i = 0; i < 0x100; i++)
+		{
+			struct callstats* s = &table[i];
+			if (!s->calls)
+				continue;
+
+			fprintf(fp, "%s\n\t\t{ \"interface\": \"%s\", \"function\": %d, \"name\": \"%s\", ",
+				first ? "" : ",",
+				bdos ? "bdos" : "bios", i, call_name(bdos, i));
+			fprintf(fp, "\"calls\": %llu, \"bytes\": %llu, \"host_ns\": %llu, \"cycles_before\": %llu, ",
+				(unsigned long long) s->calls,
+				(unsigned long long) s->bytes,
+				(unsigned long long) s->host_ns,
+				(unsigned long long) s->cycles_before);
+
+			int last = BUCKETS-1;
+			while ((last > 0) && !s->histogram[last])
+				last--;
+			fprintf(fp, "\"log2_host_ns_histogram\": [");
+			for (int b = 0; b <= last; b++)
+				fprintf(fp, "%s%llu", b ? ", " : "", (unsigned long long) s->histogram[b]);
+			fprintf(fp, "] }");
+			first = false;
+		}
+	}
+
+	fprintf(fp, "\n\t]\n}\n");
+}
+
+static void write_table(FILE* fp, uint64_t total_ns, uint64_t syscall_ns)
+{
+	fprintf(fp, "\n%-4s %3s %-13s %10s %10s %12s %10s %14s\n",
+		"", "fn", "name", "calls", "bytes", "host us", "avg ns", "cycles before");
+	for (int bdos = 0; bdos < 2; bdos++)
+	{
+		struct callstats* table = bdos ? bdos_stats : bios_stats;
+		for (int i = 0; i < 0x100; i++)
+		{
+			struct callstats* s = &table[i];
+			if (!s->calls)
+				continue;
+
+			fprintf(fp, "%-4s %3d %-13s %10llu %10llu %12llu %10llu %14llu\n",
+				bdos ? "bdos" : "bios", i, call_name(bdos, i),
+				(unsigned long long) s->calls,
+				(unsigned long long) s->bytes,
+				(unsigned long long) (s->host_ns / 1000),
+				(unsigned long long) (s->host_ns / s->calls),
+				(unsigned long long) s->cycles_before);
+		}
+	}
+
+	fprintf(fp, "\n%llu Z80 cycles; %llu us wall, of which %llu us (%.1f%%) in system calls\n",
+		(unsigned long long) cycles,
+		(unsigned long long) (total_ns / 1000),
+		(unsigned long long) (syscall_ns / 1000),
+		total_ns ? (100.0 * syscall_ns / total_ns) : 0.0);
+}
+
+static void syscallstats_dump(void)
+{
+	uint64_t total_ns = now_ns() - run_start_ns;
+	uint64_t syscall_ns = 0;
+	for (int i = 0; i < 0x100; i++)
+		syscall_ns += bios_stats[i].host_ns + bdos_stats[i].host_ns;
+
+	fflush(stdout);
+	write_table(stderr, total_ns, syscall_ns);
+
+	FILE* fp = fopen(json_filename, "w");
+	if (!fp)
+	{
+		perror(json_filename);
+		return;
+	}
+	write_json(fp, total_ns, syscall_ns);
+	fclose(fp);
+}
+
+void syscallstats_init(const char* filename)
+{
+	enabled = true;
+	json_filename = filename;
+	run_start_ns = now_ns();
+	atexit(syscallstats_dump);
+}
+
+void syscallstats_begin(bool bdos, uint8_t function)
+{
+	if (!enabled)
+		return;
+
+	current = bdos ? &bdos_stats[function] : &bios_stats[function];
+	current->calls++;
+	current->cycles_before += cycles - last_return_cycles;
+	call_start_ns = now_ns();
+}
+
+void syscallstats_end(uint32_t bytes)
+{
+	if (!enabled)
+		return;
+
+	uint64_t elapsed = now_ns() - call_start_ns;
+	current->bytes += bytes;
+	current->host_ns += elapsed;
+	current->histogram[log2_bucket(elapsed)]++;
+	last_return_cycles = cycles;
+}